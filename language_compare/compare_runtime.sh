@@ -25,7 +25,7 @@ py_program="$(_find_src_file '.py')"
 python3 -m compileall "$py_program"   &&   pyc_program="$(_find_src_file '.pyc')"  # compile python
 
 c_program="$(_find_src_file '.c')"
-gcc -O3 -m64 "$c_program" -lgmp -o "${c_program%.c}.bin"   &&   c_program="$(_find_src_file 'c.bin')"  # -03 is optimization for speed, -lgmp is GNU library "gmp" for large numbers
+gcc -O3 -m64 -pthread "$c_program" -lgmp -o "${c_program%.c}.bin"   &&   c_program="$(_find_src_file 'c.bin')"  # -03 is optimization for speed, -pthread for --threads, -lgmp is GNU library "gmp" for large numbers
 
 java_program="$(basename $(_find_src_file '.java'))"  # the ./ at the start messes up everything, must get rid of it
 # compile .class files with preview features of JDK21  # compile all .class files and choose the main class (named after its file) as the main
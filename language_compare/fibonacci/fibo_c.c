@@ -1,6 +1,7 @@
 // Calculate nth Fibonacci number, in various ways
 // Index starts at 1
 
+#define _GNU_SOURCE  // sched_setaffinity() for --pin
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,6 +9,17 @@
 #include <gmp.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 /* Fibo identities:  (might be useful for simpler computation choices)
 0) F(k+1) = F(k)+F(k-1)
@@ -176,200 +188,3367 @@ F(2n) has F(n) `F(n+1)` times, F(n-1) `F(n)` times
 
 
 
+// Run options that reach deeper than the algorithm choice. Set once by main() before anything is calculated.
+typedef enum { OUT_DECIMAL, OUT_HEX, OUT_RAW } out_format_t;
+
+typedef struct {
+    bool is_prealloc;   // size every big number once from the goal index, instead of letting GMP grow them step by step
+    bool is_mem_stats;  // report GMP's allocation traffic to stderr when done
+    int threads;        // cores the big multiplications (and the decimal conversion) may spread over
+    out_format_t format;  // how the result is printed
+    const char *cache_path;  // checkpoint file to resume from and add to, NULL for none
+    const char *config_path;  // --algo auto thresholds, NULL for the default location
+    size_t mem_limit;   // bytes of GMP blocks to keep in RAM before the big ones go to scratch files, 0 for no limit
+    const char *scratch_dir;  // where those files go, NULL for $TMPDIR or /tmp
+    bool is_progress;   // per-step progress and ETA on stderr (lean ladder)
+} fib_options_t;
+
+static fib_options_t fib_opts = { 0 };
+
+static void mem_out_of_memory(size_t size)
+{
+    fprintf(stderr, "Out of memory while allocating %zu bytes\n", size);
+    exit(9);  // same status as "numbers became too big to handle" in compare_runtime.sh
+}
+
+
+// Out-of-core memory (--mem-limit <size>). GMP's blocks stay in RAM until their total would pass the limit; from then on,
+// every block of OOC_MIN_MAP_BYTES or more is a shared mapping of its own file in the scratch directory (--scratch, default
+// $TMPDIR or /tmp), unlinked right away so it goes when the block does. The kernel writes those pages back to their files
+// and drops them when RAM runs short, rather than the OOM killer ending the run, so the ceiling becomes free disk space.
+// The multiplications go through their operands in long sequential runs (GMP's FFT, the NTT's blocked passes), which is
+// what readahead and writeback handle well; MADV_SEQUENTIAL tells the kernel so. Space is reserved with posix_fallocate,
+// so a full disk fails the allocation (exit 9, like running out of memory) instead of a SIGBUS in the middle of a product.
+// Mapped blocks never shrink below OOC_MIN_MAP_BYTES (they move back to RAM), so a smaller block is never a mapping.
+#define OOC_MIN_MAP_BYTES (1 << 20)
+#define OOC_MAX_MAPS 256    // live mapped blocks; the ladders keep a handful, GMP's FFT a few dozen at most
+
+typedef struct {
+    void *ptr;
+    size_t size;
+    int fd;
+} ooc_map_t;
+
+static struct {
+    ooc_map_t maps[OOC_MAX_MAPS];
+    int n_maps;
+    size_t ram_bytes;               // GMP's blocks in RAM, only counted with --mem-limit
+    uint64_t n_mapped;              // blocks that went to scratch files, for --mem-stats
+    size_t mapped_bytes, peak_mapped_bytes;
+    pthread_mutex_t lock;           // with --threads, the workers allocate too
+} ooc = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static bool ooc_is_over(size_t old_size, size_t new_size)
+{
+    return new_size >= OOC_MIN_MAP_BYTES && __atomic_load_n(&ooc.ram_bytes, __ATOMIC_RELAXED) - old_size + new_size > fib_opts.mem_limit;
+}
+
+static void ooc_reserve(int fd, size_t size)
+{
+    int err = posix_fallocate(fd, 0, (off_t)size);
+    if (err == 0) return;
+    fprintf(stderr, "No room for a %zu bytes scratch file: %s\n", size, strerror(err));
+    exit(9);
+}
+
+// a fresh mapping, or NULL when the table is full (the block then stays in RAM)
+static void *ooc_map(size_t size)
+{
+    pthread_mutex_lock(&ooc.lock);
+    if (ooc.n_maps == OOC_MAX_MAPS) return pthread_mutex_unlock(&ooc.lock), NULL;
+
+    const char *dir = fib_opts.scratch_dir ? fib_opts.scratch_dir : getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/fibo_c.XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) { fprintf(stderr, "Can't create a scratch file in %s: %s\n", dir, strerror(errno)); exit(9); }
+    unlink(path);
+    ooc_reserve(fd, size);
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) mem_out_of_memory(size);
+    madvise(ptr, size, MADV_SEQUENTIAL);
+
+    ooc.maps[ooc.n_maps++] = (ooc_map_t){ ptr, size, fd };
+    ooc.n_mapped++;
+    ooc.mapped_bytes += size;
+    if (ooc.mapped_bytes > ooc.peak_mapped_bytes) ooc.peak_mapped_bytes = ooc.mapped_bytes;
+    pthread_mutex_unlock(&ooc.lock);
+    return ptr;
+}
+
+// index of ptr's mapping, or -1; called under the lock
+static int ooc_find(const void *ptr)
+{
+    for (int i = 0; i < ooc.n_maps; i++) if (ooc.maps[i].ptr == ptr) return i;
+    return -1;
+}
+
+static void ooc_unmap_at(int i)
+{
+    munmap(ooc.maps[i].ptr, ooc.maps[i].size);
+    close(ooc.maps[i].fd);
+    ooc.mapped_bytes -= ooc.maps[i].size;
+    ooc.maps[i] = ooc.maps[--ooc.n_maps];
+}
+
+static void *ooc_alloc(size_t size)
+{
+    if (fib_opts.mem_limit && ooc_is_over(0, size))
+    {
+        void *ptr = ooc_map(size);
+        if (ptr) return ptr;
+    }
+    void *ptr = malloc(size);
+    if (!ptr) mem_out_of_memory(size);
+    if (fib_opts.mem_limit) __atomic_fetch_add(&ooc.ram_bytes, size, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void ooc_free(void *ptr, size_t size)
+{
+    if (fib_opts.mem_limit && size >= OOC_MIN_MAP_BYTES)
+    {
+        pthread_mutex_lock(&ooc.lock);
+        int i = ooc_find(ptr);
+        if (i >= 0) ooc_unmap_at(i);
+        pthread_mutex_unlock(&ooc.lock);
+        if (i >= 0) return;
+    }
+    free(ptr);
+    if (fib_opts.mem_limit) __atomic_fetch_sub(&ooc.ram_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void *ooc_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    if (fib_opts.mem_limit && old_size >= OOC_MIN_MAP_BYTES)  // a mapping grows (or shrinks) with its file
+    {
+        pthread_mutex_lock(&ooc.lock);
+        int i = ooc_find(ptr);
+        if (i >= 0 && new_size >= OOC_MIN_MAP_BYTES)
+        {
+            ooc_map_t *m = &ooc.maps[i];
+            if (new_size > m->size) ooc_reserve(m->fd, new_size);
+            void *moved = mremap(m->ptr, m->size, new_size, MREMAP_MAYMOVE);
+            if (moved == MAP_FAILED) mem_out_of_memory(new_size);
+            ooc.mapped_bytes += new_size - m->size;
+            if (ooc.mapped_bytes > ooc.peak_mapped_bytes) ooc.peak_mapped_bytes = ooc.mapped_bytes;
+            m->ptr = moved;
+            m->size = new_size;
+            pthread_mutex_unlock(&ooc.lock);
+            return moved;
+        }
+        pthread_mutex_unlock(&ooc.lock);
+        if (i >= 0)  // too small to stay a mapping
+        {
+            void *moved = ooc_alloc(new_size);
+            memcpy(moved, ptr, new_size);
+            ooc_free(ptr, old_size);
+            return moved;
+        }
+    }
+    if (fib_opts.mem_limit && ooc_is_over(old_size, new_size))  // in RAM, but it wouldn't fit anymore
+    {
+        void *moved = ooc_map(new_size);
+        if (moved)
+        {
+            memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+            ooc_free(ptr, old_size);
+            return moved;
+        }
+    }
+    ptr = realloc(ptr, new_size);
+    if (!ptr) mem_out_of_memory(new_size);
+    if (fib_opts.mem_limit) __atomic_fetch_add(&ooc.ram_bytes, new_size - old_size, __ATOMIC_RELAXED);  // wraps back when shrinking
+    return ptr;
+}
+
+
+
+// Memory accounting. GMP takes all of its memory (including its multiplication temporaries) through these, and tells us the
+// old/new sizes on every realloc/free, so live and peak bytes can be tracked without headers on the blocks.
+typedef struct {
+    uint64_t allocs, reallocs, frees;
+    uint64_t bytes_allocated;  // everything handed out: fresh blocks plus realloc growth
+    size_t live_bytes, peak_bytes;
+} mem_stats_t;
+
+static mem_stats_t mem_stats = { 0 };
+
+// with --threads, the workers allocate too, so the counters are only touched atomically
+#define MEM_COUNT(field, amount) __atomic_fetch_add(&mem_stats.field, (amount), __ATOMIC_RELAXED)
+
+static void mem_note_live(size_t old_size, size_t new_size)
+{
+    size_t live = __atomic_add_fetch(&mem_stats.live_bytes, new_size - old_size, __ATOMIC_RELAXED);  // wraps back correctly when shrinking
+    size_t peak = __atomic_load_n(&mem_stats.peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&mem_stats.peak_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+}
+
+static void *mem_counting_alloc(size_t size)
+{
+    void *ptr = ooc_alloc(size);
+    MEM_COUNT(allocs, 1);
+    MEM_COUNT(bytes_allocated, size);
+    mem_note_live(0, size);
+    return ptr;
+}
+
+static void *mem_counting_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    ptr = ooc_realloc(ptr, old_size, new_size);
+    MEM_COUNT(reallocs, 1);
+    if (new_size > old_size) MEM_COUNT(bytes_allocated, new_size - old_size);
+    mem_note_live(old_size, new_size);
+    return ptr;
+}
+
+static void mem_counting_free(void *ptr, size_t size)
+{
+    ooc_free(ptr, size);
+    MEM_COUNT(frees, 1);
+    mem_note_live(size, 0);
+}
+
+// with --mem-stats or --mem-limit (the counting is cheap next to what GMP does with the blocks)
+void mem_hooks_start(void) { mp_set_memory_functions(mem_counting_alloc, mem_counting_realloc, mem_counting_free); }
+
+void mem_stats_report(FILE *out)
+{
+    fprintf(out, "allocations: %llu, reallocations: %llu, frees: %llu, bytes allocated: %llu, peak live bytes: %zu\n",
+        (unsigned long long)mem_stats.allocs, (unsigned long long)mem_stats.reallocs, (unsigned long long)mem_stats.frees,
+        (unsigned long long)mem_stats.bytes_allocated, mem_stats.peak_bytes);
+    if (fib_opts.mem_limit)
+        fprintf(out, "blocks in scratch files: %llu, peak scratch bytes: %zu\n", (unsigned long long)ooc.n_mapped, ooc.peak_mapped_bytes);
+}
+
+
+// Worker pool. Persistent threads that run "task i of n" batches; the calling thread takes tasks too, so --threads N means
+// N-1 workers. Batches don't nest: when a task calls pool_run() itself (or asks pool_threads()), it runs that batch alone.
+typedef void (*pool_task_fn)(void *ctx, size_t task);
+
+typedef struct {
+    pthread_t *workers;
+    int n_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t has_work, is_done;
+    pool_task_fn fn;
+    void *ctx;
+    size_t n_tasks, next_task, n_finished;
+    bool is_stopping;
+} worker_pool_t;
+
+static worker_pool_t *fib_pool = NULL;  // NULL when single-threaded
+static __thread bool pool_is_in_task = false;
+
+static void *pool_worker(void *arg)
+{
+    worker_pool_t *p = arg;
+    pool_is_in_task = true;
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        while (!p->is_stopping && p->next_task >= p->n_tasks) pthread_cond_wait(&p->has_work, &p->lock);
+        if (p->is_stopping) break;
+
+        size_t task = p->next_task++;
+        pool_task_fn fn = p->fn;
+        void *ctx = p->ctx;
+        pthread_mutex_unlock(&p->lock);
+        fn(ctx, task);
+        pthread_mutex_lock(&p->lock);
+        if (++p->n_finished == p->n_tasks) pthread_cond_broadcast(&p->is_done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+worker_pool_t *pool_create(int n_workers)
+{
+    worker_pool_t *p = calloc(1, sizeof(*p));
+    p->workers = calloc(n_workers, sizeof(pthread_t));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->has_work, NULL);
+    pthread_cond_init(&p->is_done, NULL);
+    for (p->n_workers = 0; p->n_workers < n_workers; p->n_workers++)
+        if (pthread_create(&p->workers[p->n_workers], NULL, pool_worker, p) != 0) break;  // run with whatever we got
+    return p;
+}
+
+void pool_destroy(worker_pool_t *p)
+{
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    p->is_stopping = true;
+    pthread_cond_broadcast(&p->has_work);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->n_workers; i++) pthread_join(p->workers[i], NULL);
+    pthread_cond_destroy(&p->has_work);
+    pthread_cond_destroy(&p->is_done);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p);
+}
+
+// runs fn(ctx, 0..n_tasks-1) and returns when all are done
+void pool_run(worker_pool_t *p, pool_task_fn fn, void *ctx, size_t n_tasks)
+{
+    if (!p || p->n_workers == 0 || n_tasks == 1 || pool_is_in_task)
+    {
+        for (size_t i = 0; i < n_tasks; i++) fn(ctx, i);
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->ctx = ctx;
+    p->n_tasks = n_tasks;
+    p->next_task = p->n_finished = 0;
+    pthread_cond_broadcast(&p->has_work);
+    while (p->next_task < p->n_tasks)  // pitch in
+    {
+        size_t task = p->next_task++;
+        pthread_mutex_unlock(&p->lock);
+        pool_is_in_task = true;
+        fn(ctx, task);
+        pool_is_in_task = false;
+        pthread_mutex_lock(&p->lock);
+        p->n_finished++;
+    }
+    while (p->n_finished < p->n_tasks) pthread_cond_wait(&p->is_done, &p->lock);
+    p->n_tasks = p->next_task = 0;  // park the workers
+    pthread_mutex_unlock(&p->lock);
+}
+
+static int pool_threads(void) { return fib_pool && !pool_is_in_task ? fib_pool->n_workers + 1 : 1; }
+
+
+// Parallel multiplication. Every job of a batch is independent (e.g. F(k)^2 and F(k+1)F(k) of a doubling step).
+// Jobs that are big enough are also split into Karatsuba sub-products, a few levels deep, so a single huge product
+// spreads across cores too: a*b = z2*B^2h + (zm-z0-z2)*B^h + z0 with z0=a0*b0, z2=a1*b1, zm=(a0+a1)(b0+b1).
+// All the leaf products of the batch run as one pool_run(), and the tree is put back together on the calling thread.
+#define PAR_MUL_MIN_LIMBS 2000  // below this, thread hand-off and the Karatsuba additions cost more than they save
+#define PAR_MUL_MAX_DEPTH 4     // 3^4 = 81 leaves per job at most
+
+typedef struct {
+    mpz_ptr out;
+    mpz_srcptr a, b;  // b == a is a squaring
+} mul_job_t;
+
+typedef struct kara_node {
+    mpz_ptr out;
+    mpz_srcptr a, b;
+    bool is_leaf;
+    size_t h;                        // split point, in limbs
+    mpz_t sa, sb;                    // a0+a1, b0+b1
+    mpz_t z[3];                      // a0*b0, a1*b1, (a0+a1)(b0+b1)
+    __mpz_struct halves[4];          // read-only views of a0, a1, b0, b1 (mpz_roinit_n, nothing to clear)
+    struct kara_node *child[3];
+} kara_node_t;
+
+typedef struct {
+    mul_job_t *leaves;
+    size_t n_leaves, cap_leaves;
+} kara_leaves_t;
+
+static void mul_leaf_task(void *ctx, size_t task)
+{
+    mul_job_t *leaf = &((mul_job_t *)ctx)[task];
+    mpz_mul(leaf->out, leaf->a, leaf->b);
+}
+
+static void kara_add_leaf(kara_leaves_t *ls, mpz_ptr out, mpz_srcptr a, mpz_srcptr b)
+{
+    if (ls->n_leaves == ls->cap_leaves)
+    {
+        ls->cap_leaves = ls->cap_leaves ? 2 * ls->cap_leaves : 16;
+        ls->leaves = realloc(ls->leaves, ls->cap_leaves * sizeof(mul_job_t));
+    }
+    ls->leaves[ls->n_leaves++] = (mul_job_t){ out, a, b };
+}
+
+static kara_node_t *kara_expand(kara_leaves_t *ls, mpz_ptr out, mpz_srcptr a, mpz_srcptr b, int depth)
+{
+    kara_node_t *node = calloc(1, sizeof(*node));
+    node->out = out; node->a = a; node->b = b;
+
+    size_t an = mpz_size(a), bn = mpz_size(b);
+    size_t h = (an > bn ? an : bn) / 2;
+    // both halves of both operands must be non-trivial, and only non-negative values are split (all of ours are)
+    node->is_leaf = depth == 0 || h < PAR_MUL_MIN_LIMBS / 2 || an <= h || bn <= h || mpz_sgn(a) < 0 || mpz_sgn(b) < 0;
+    if (node->is_leaf)
+    {
+        kara_add_leaf(ls, out, a, b);
+        return node;
+    }
+
+    bool is_sqr = a == b;
+    node->h = h;
+    const mp_limb_t *ap = mpz_limbs_read(a), *bp = mpz_limbs_read(b);
+    mpz_roinit_n(&node->halves[0], ap, h);
+    mpz_roinit_n(&node->halves[1], ap + h, an - h);
+    mpz_roinit_n(&node->halves[2], bp, h);
+    mpz_roinit_n(&node->halves[3], bp + h, bn - h);
+
+    mpz_init(node->sa);
+    mpz_add(node->sa, &node->halves[0], &node->halves[1]);
+    mpz_init(node->sb);
+    if (!is_sqr) mpz_add(node->sb, &node->halves[2], &node->halves[3]);
+    for (int i = 0; i < 3; i++) mpz_init(node->z[i]);
+
+    node->child[0] = kara_expand(ls, node->z[0], &node->halves[0], is_sqr ? &node->halves[0] : &node->halves[2], depth - 1);
+    node->child[1] = kara_expand(ls, node->z[1], &node->halves[1], is_sqr ? &node->halves[1] : &node->halves[3], depth - 1);
+    node->child[2] = kara_expand(ls, node->z[2], node->sa, is_sqr ? node->sa : node->sb, depth - 1);
+    return node;
+}
+
+static void kara_combine(kara_node_t *node)
+{
+    if (!node->is_leaf)
+    {
+        for (int i = 0; i < 3; i++) kara_combine(node->child[i]);
+
+        mp_bitcnt_t shift = (mp_bitcnt_t)node->h * GMP_NUMB_BITS;
+        mpz_sub(node->z[2], node->z[2], node->z[0]);
+        mpz_sub(node->z[2], node->z[2], node->z[1]);   // zm - z0 - z2
+        mpz_mul_2exp(node->out, node->z[1], 2 * shift);
+        mpz_mul_2exp(node->z[2], node->z[2], shift);
+        mpz_add(node->out, node->out, node->z[2]);
+        mpz_add(node->out, node->out, node->z[0]);
+
+        for (int i = 0; i < 3; i++) mpz_clear(node->z[i]);
+        mpz_clear(node->sa);
+        mpz_clear(node->sb);
+    }
+    free(node);
+}
+
+void gmp_mul_batch(mul_job_t *jobs, int n_jobs)
+{
+    size_t biggest = 0;
+    for (int i = 0; i < n_jobs; i++) if (mpz_size(jobs[i].a) > biggest) biggest = mpz_size(jobs[i].a);
+
+    int threads = pool_threads();
+    if (threads == 1 || biggest < PAR_MUL_MIN_LIMBS)
+    {
+        for (int i = 0; i < n_jobs; i++) mpz_mul(jobs[i].out, jobs[i].a, jobs[i].b);
+        return;
+    }
+
+    int depth = 0;
+    for (int leaves = n_jobs; leaves < threads && depth < PAR_MUL_MAX_DEPTH; leaves *= 3) depth++;
+
+    kara_leaves_t ls = { 0 };
+    kara_node_t *roots[n_jobs];
+    for (int i = 0; i < n_jobs; i++) roots[i] = kara_expand(&ls, jobs[i].out, jobs[i].a, jobs[i].b, depth);
+
+    pool_run(fib_pool, mul_leaf_task, ls.leaves, ls.n_leaves);
+
+    for (int i = 0; i < n_jobs; i++) kara_combine(roots[i]);
+    free(ls.leaves);
+}
+
+// Number-theoretic-transform multiplication (--mul ntt). Operands are cut into 30-bit digits and convolved modulo three
+// NTT-friendly primes, then the exact coefficients are put back together with the CRT (Garner).
+// Why it fits: a coefficient is at most len * (2^30)^2 <= 2^84 for len <= 2^24, and p0*p1*p2 ~ 2^85.6.
+// Values live in [0,p). Twiddles are kept in Montgomery form (w*2^32 mod p), so mont_mul(x, w) = x*w and the data stays
+// in normal form. The butterflies come in scalar/SSE4.2/AVX2/AVX-512 flavors, chosen by CPUID on first use
+// (FIBO_NTT_ISA=scalar|sse4.2|avx2|avx512 in the environment overrides, to test each one).
+#define NTT_DIGIT_BITS 30
+#define NTT_DIGIT_MASK ((1u << NTT_DIGIT_BITS) - 1)
+#define NTT_LOG_MAX_LEN 24       // 2^24 divides p-1 for all three primes, and keeps the coefficient bound above
+#define NTT_MIN_LIMBS 6000       // below this GMP's own FFT wins, the job goes to the gmp backend
+
+typedef struct {
+    uint32_t p;             // prime
+    uint32_t g;             // primitive root
+    uint32_t pinv;          // p^-1 mod 2^32
+    uint32_t r1;            // 2^32 mod p, Montgomery form of 1
+    uint32_t *tw, *itw;     // [m+j] = w_2m^j and w_2m^-j in Montgomery form, for 2m <= tw_len. Under ntt_tw_lock
+    size_t tw_len;
+} ntt_prime_t;
+
+static ntt_prime_t ntt_primes[3] = {
+    { .p = 754974721, .g = 11 },   // 45*2^24+1
+    { .p = 167772161, .g = 3 },    // 5*2^25+1
+    { .p = 469762049, .g = 3 },    // 7*2^26+1
+};
+
+static uint64_t ntt_pow_mod(uint64_t base, uint64_t exp, uint64_t p)
+{
+    uint64_t result = 1;
+    for (base %= p; exp; exp >>= 1, base = base * base % p) if (exp & 1) result = result * base % p;
+    return result;
+}
+
+static uint32_t ntt_to_mont(uint64_t x, uint32_t p) { return (uint32_t)(((x % p) << 32) % p); }
+
+// a*b/2^32 mod p, for a*b < p*2^32. The low halves of a*b and q*p cancel, so only the high halves get subtracted.
+static inline uint32_t ntt_mont_mul(uint32_t a, uint32_t b, const ntt_prime_t *P)
+{
+    uint64_t t = (uint64_t)a * b;
+    uint32_t q = (uint32_t)t * P->pinv;
+    uint32_t r = (uint32_t)(t >> 32) - (uint32_t)(((uint64_t)q * P->p) >> 32);
+    return (int32_t)r < 0 ? r + P->p : r;
+}
+static inline uint32_t ntt_add(uint32_t a, uint32_t b, uint32_t p) { uint32_t s = a + b; return s >= p ? s - p : s; }
+static inline uint32_t ntt_sub(uint32_t a, uint32_t b, uint32_t p) { uint32_t d = a - b; return (int32_t)d < 0 ? d + p : d; }
+
+// One radix-2 stage over the whole array: DIF (forward, natural in -> bit-reversed out) or DIT (inverse, the other way around).
+// w points at the stage's twiddles, w[j] for j < m.
+typedef struct {
+    const char *name;
+    void (*dif_stage)(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P);
+    void (*dit_stage)(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P);
+    void (*pointwise)(uint32_t *a, const uint32_t *b, size_t len, const ntt_prime_t *P);  // a *= b
+    void (*garner)(uint32_t *res[3], size_t len, const uint32_t scale[3]);  // residues -> (a0, t1, t2) in place, see ntt_store()
+} ntt_kernels_t;
+
+static void ntt_dif_stage_scalar(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P)
+{
+    for (size_t i = 0; i < len; i += 2*m)
+        for (size_t j = 0; j < m; j++)
+        {
+            uint32_t u = a[i+j], v = a[i+j+m];
+            a[i+j] = ntt_add(u, v, P->p);
+            a[i+j+m] = ntt_mont_mul(ntt_sub(u, v, P->p), w[j], P);
+        }
+}
+
+static void ntt_dit_stage_scalar(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P)
+{
+    for (size_t i = 0; i < len; i += 2*m)
+        for (size_t j = 0; j < m; j++)
+        {
+            uint32_t u = a[i+j], v = ntt_mont_mul(a[i+j+m], w[j], P);
+            a[i+j] = ntt_add(u, v, P->p);
+            a[i+j+m] = ntt_sub(u, v, P->p);
+        }
+}
+
+static void ntt_pointwise_scalar(uint32_t *a, const uint32_t *b, size_t len, const ntt_prime_t *P)
+{
+    for (size_t i = 0; i < len; i++) a[i] = ntt_mont_mul(a[i], b[i], P);
+}
+
+static uint32_t ntt_crt_c1, ntt_crt_c2a, ntt_crt_c2b;  // Garner constants, see ntt_store()
+
+static void ntt_garner_scalar(uint32_t *res[3], size_t len, const uint32_t scale[3])
+{
+    const ntt_prime_t *P0 = &ntt_primes[0], *P1 = &ntt_primes[1], *P2 = &ntt_primes[2];
+    for (size_t i = 0; i < len; i++)
+    {
+        uint32_t a0 = ntt_mont_mul(res[0][i], scale[0], P0);
+        uint32_t a1 = ntt_mont_mul(res[1][i], scale[1], P1);
+        uint32_t a2 = ntt_mont_mul(res[2][i], scale[2], P2);
+        uint32_t t1 = ntt_sub(ntt_mont_mul(a1, ntt_crt_c1, P1), ntt_mont_mul(a0, ntt_crt_c1, P1), P1->p);
+        res[0][i] = a0;
+        res[1][i] = t1;
+        res[2][i] = ntt_sub(ntt_sub(ntt_mont_mul(a2, ntt_crt_c2a, P2), ntt_mont_mul(a0, ntt_crt_c2a, P2), P2->p), ntt_mont_mul(t1, ntt_crt_c2b, P2), P2->p);
+    }
+}
+
+static const ntt_kernels_t ntt_kernels_scalar = { "scalar", ntt_dif_stage_scalar, ntt_dit_stage_scalar, ntt_pointwise_scalar, ntt_garner_scalar };
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// The vector flavors share one body; each ISA supplies VEC, LANES and the VEC_* helpers below.
+// Montgomery on vectors: _mul_epu32 multiplies the even 32-bit lanes, so the odd lanes go through a second round shifted down.
+// add/sub fold back into [0,p) with min_epu32: whichever of x and x-p (or x+p) didn't wrap around is the smaller one.
+// Stages with m < LANES have both ends of a butterfly in the same vector; NTT_TAIL handles those (see the per-ISA tails).
+#define NTT_DEFINE_VECTOR_KERNELS(isa, isa_target)                                                                         \
+    __attribute__((target(isa_target))) static void ntt_dif_stage_##isa(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P) \
+    {                                                                                                                  \
+        if (m < LANES) { NTT_TAIL(ntt_dif_stage_scalar, true, a, len, m, w, P); return; }                              \
+        VEC p = VEC_SET1(P->p), pinv = VEC_SET1(P->pinv);                                                              \
+        for (size_t i = 0; i < len; i += 2*m)                                                                          \
+            for (size_t j = 0; j < m; j += LANES)                                                                      \
+            {                                                                                                          \
+                VEC u = VEC_LOAD(a+i+j), v = VEC_LOAD(a+i+j+m);                                                        \
+                VEC_STORE(a+i+j, VEC_ADD(u, v, p));                                                                    \
+                VEC_STORE(a+i+j+m, VEC_MONT(VEC_SUB(u, v, p), VEC_LOAD(w+j), p, pinv));                               \
+            }                                                                                                          \
+    }                                                                                                                  \
+    __attribute__((target(isa_target))) static void ntt_dit_stage_##isa(uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P) \
+    {                                                                                                                  \
+        if (m < LANES) { NTT_TAIL(ntt_dit_stage_scalar, false, a, len, m, w, P); return; }                             \
+        VEC p = VEC_SET1(P->p), pinv = VEC_SET1(P->pinv);                                                              \
+        for (size_t i = 0; i < len; i += 2*m)                                                                          \
+            for (size_t j = 0; j < m; j += LANES)                                                                      \
+            {                                                                                                          \
+                VEC u = VEC_LOAD(a+i+j), v = VEC_MONT(VEC_LOAD(a+i+j+m), VEC_LOAD(w+j), p, pinv);                      \
+                VEC_STORE(a+i+j, VEC_ADD(u, v, p));                                                                    \
+                VEC_STORE(a+i+j+m, VEC_SUB(u, v, p));                                                                  \
+            }                                                                                                          \
+    }                                                                                                                  \
+    __attribute__((target(isa_target))) static void ntt_pointwise_##isa(uint32_t *a, const uint32_t *b, size_t len, const ntt_prime_t *P) \
+    {                                                                                                                  \
+        if (len < LANES) { ntt_pointwise_scalar(a, b, len, P); return; }                                               \
+        VEC p = VEC_SET1(P->p), pinv = VEC_SET1(P->pinv);                                                              \
+        for (size_t i = 0; i < len; i += LANES) VEC_STORE(a+i, VEC_MONT(VEC_LOAD(a+i), VEC_LOAD(b+i), p, pinv));       \
+    }                                                                                                                  \
+    __attribute__((target(isa_target))) static void ntt_garner_##isa(uint32_t *res[3], size_t len, const uint32_t scale[3]) \
+    {                                                                                                                  \
+        if (len < LANES) { ntt_garner_scalar(res, len, scale); return; }                                               \
+        VEC p0 = VEC_SET1(ntt_primes[0].p), pinv0 = VEC_SET1(ntt_primes[0].pinv);                                      \
+        VEC p1 = VEC_SET1(ntt_primes[1].p), pinv1 = VEC_SET1(ntt_primes[1].pinv);                                      \
+        VEC p2 = VEC_SET1(ntt_primes[2].p), pinv2 = VEC_SET1(ntt_primes[2].pinv);                                      \
+        VEC s0 = VEC_SET1(scale[0]), s1 = VEC_SET1(scale[1]), s2 = VEC_SET1(scale[2]);                                 \
+        VEC c1 = VEC_SET1(ntt_crt_c1), c2a = VEC_SET1(ntt_crt_c2a), c2b = VEC_SET1(ntt_crt_c2b);                       \
+        for (size_t i = 0; i < len; i += LANES)                                                                        \
+        {                                                                                                              \
+            VEC a0 = VEC_MONT(VEC_LOAD(res[0]+i), s0, p0, pinv0);                                                      \
+            VEC a1 = VEC_MONT(VEC_LOAD(res[1]+i), s1, p1, pinv1);                                                      \
+            VEC a2 = VEC_MONT(VEC_LOAD(res[2]+i), s2, p2, pinv2);                                                      \
+            VEC t1 = VEC_SUB(VEC_MONT(a1, c1, p1, pinv1), VEC_MONT(a0, c1, p1, pinv1), p1);                            \
+            VEC t2 = VEC_SUB(VEC_SUB(VEC_MONT(a2, c2a, p2, pinv2), VEC_MONT(a0, c2a, p2, pinv2), p2), VEC_MONT(t1, c2b, p2, pinv2), p2); \
+            VEC_STORE(res[0]+i, a0);                                                                                   \
+            VEC_STORE(res[1]+i, t1);                                                                                   \
+            VEC_STORE(res[2]+i, t2);                                                                                   \
+        }                                                                                                              \
+    }                                                                                                                  \
+    static const ntt_kernels_t ntt_kernels_##isa = { #isa, ntt_dif_stage_##isa, ntt_dit_stage_##isa, ntt_pointwise_##isa, ntt_garner_##isa };
+
+// SSE4.2 (min_epu32 and blend_epi16 are SSE4.1)
+__attribute__((target("sse4.2"))) static inline __m128i ntt_mont_sse(__m128i a, __m128i b, __m128i p, __m128i pinv)
+{
+    __m128i t_even = _mm_mul_epu32(a, b), t_odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    __m128i qp_even = _mm_mul_epu32(_mm_mul_epu32(t_even, pinv), p), qp_odd = _mm_mul_epu32(_mm_mul_epu32(t_odd, pinv), p);
+    __m128i r = _mm_blend_epi16(_mm_srli_epi64(_mm_sub_epi64(t_even, qp_even), 32), _mm_sub_epi64(t_odd, qp_odd), 0xCC);
+    return _mm_min_epu32(r, _mm_add_epi32(r, p));
+}
+#define VEC __m128i
+#define LANES 4
+#define VEC_SET1(x) _mm_set1_epi32((int)(x))
+#define VEC_LOAD(ptr) _mm_loadu_si128((const __m128i *)(ptr))
+#define VEC_STORE(ptr, x) _mm_storeu_si128((__m128i *)(ptr), x)
+#define VEC_ADD(x, y, p) ({ __m128i s_ = _mm_add_epi32(x, y); _mm_min_epu32(s_, _mm_sub_epi32(s_, p)); })
+#define VEC_SUB(x, y, p) ({ __m128i d_ = _mm_sub_epi32(x, y); _mm_min_epu32(d_, _mm_add_epi32(d_, p)); })
+#define VEC_MONT ntt_mont_sse
+#define NTT_TAIL(scalar_stage, is_dif, a, len, m, w, P) scalar_stage(a, len, m, w, P)  // the fallback ISA doesn't get shuffled tails
+NTT_DEFINE_VECTOR_KERNELS(sse42, "sse4.2")
+#undef NTT_TAIL
+#undef VEC
+#undef LANES
+#undef VEC_SET1
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MONT
+
+// AVX2
+__attribute__((target("avx2"))) static inline __m256i ntt_mont_avx2(__m256i a, __m256i b, __m256i p, __m256i pinv)
+{
+    __m256i t_even = _mm256_mul_epu32(a, b), t_odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    __m256i qp_even = _mm256_mul_epu32(_mm256_mul_epu32(t_even, pinv), p), qp_odd = _mm256_mul_epu32(_mm256_mul_epu32(t_odd, pinv), p);
+    __m256i r = _mm256_blend_epi32(_mm256_srli_epi64(_mm256_sub_epi64(t_even, qp_even), 32), _mm256_sub_epi64(t_odd, qp_odd), 0xAA);
+    return _mm256_min_epu32(r, _mm256_add_epi32(r, p));
+}
+// Tail stages on AVX2 (m = 1, 2, 4): two vectors hold 8 butterflies. Lanes are gathered into a U and a V vector
+// (butterfly q of A comes from A, of B from B), run through the usual butterfly, and scattered back.
+typedef struct { __m256i gather_u, gather_v, scatter, is_v_lane, w_pattern; } ntt_tail_avx2_t;
+
+__attribute__((target("avx2"))) static ntt_tail_avx2_t ntt_tail_setup_avx2(size_t m, const uint32_t *w)
+{
+    uint32_t gu[8], gv[8], sc[8], isv[8], wp[8];
+    for (size_t q = 0; q < 8; q++)
+    {
+        size_t u = (q / m) * 2*m + q % m;
+        gu[q] = u % 8; gv[q] = (u + m) % 8; wp[q] = w[q % m];
+    }
+    for (size_t pos = 0; pos < 8; pos++)  // position within A (the pattern repeats for B, shifted by 4 butterflies)
+    {
+        bool is_v = pos % (2*m) >= m;
+        sc[pos] = (pos / (2*m)) * m + pos % m;
+        isv[pos] = is_v ? ~0u : 0;
+    }
+    return (ntt_tail_avx2_t){ _mm256_loadu_si256((void *)gu), _mm256_loadu_si256((void *)gv), _mm256_loadu_si256((void *)sc),
+                              _mm256_loadu_si256((void *)isv), _mm256_loadu_si256((void *)wp) };
+}
+
+__attribute__((target("avx2"))) static void ntt_tail_avx2(bool is_dif, uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P)
+{
+    if (len < 16) { (is_dif ? ntt_dif_stage_scalar : ntt_dit_stage_scalar)(a, len, m, w, P); return; }
+    ntt_tail_avx2_t t = ntt_tail_setup_avx2(m, w);
+    __m256i p = _mm256_set1_epi32((int)P->p), pinv = _mm256_set1_epi32((int)P->pinv);
+    __m256i high_half = _mm256_set1_epi32(4);
+    for (size_t i = 0; i < len; i += 16)
+    {
+        __m256i A = _mm256_loadu_si256((__m256i *)(a+i)), B = _mm256_loadu_si256((__m256i *)(a+i+8));
+        __m256i U = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(A, t.gather_u), _mm256_permutevar8x32_epi32(B, t.gather_u), 0xF0);
+        __m256i V = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(A, t.gather_v), _mm256_permutevar8x32_epi32(B, t.gather_v), 0xF0);
+        __m256i U2, V2;
+        if (is_dif)
+        {
+            __m256i s = _mm256_add_epi32(U, V), d = _mm256_sub_epi32(U, V);
+            U2 = _mm256_min_epu32(s, _mm256_sub_epi32(s, p));
+            V2 = ntt_mont_avx2(_mm256_min_epu32(d, _mm256_add_epi32(d, p)), t.w_pattern, p, pinv);
+        }
+        else
+        {
+            V = ntt_mont_avx2(V, t.w_pattern, p, pinv);
+            __m256i s = _mm256_add_epi32(U, V), d = _mm256_sub_epi32(U, V);
+            U2 = _mm256_min_epu32(s, _mm256_sub_epi32(s, p));
+            V2 = _mm256_min_epu32(d, _mm256_add_epi32(d, p));
+        }
+        __m256i scatter_b = _mm256_add_epi32(t.scatter, high_half);
+        A = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(U2, t.scatter), _mm256_permutevar8x32_epi32(V2, t.scatter), t.is_v_lane);
+        B = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(U2, scatter_b), _mm256_permutevar8x32_epi32(V2, scatter_b), t.is_v_lane);
+        _mm256_storeu_si256((__m256i *)(a+i), A);
+        _mm256_storeu_si256((__m256i *)(a+i+8), B);
+    }
+}
+
+#define VEC __m256i
+#define LANES 8
+#define VEC_SET1(x) _mm256_set1_epi32((int)(x))
+#define VEC_LOAD(ptr) _mm256_loadu_si256((const __m256i *)(ptr))
+#define VEC_STORE(ptr, x) _mm256_storeu_si256((__m256i *)(ptr), x)
+#define VEC_ADD(x, y, p) ({ __m256i s_ = _mm256_add_epi32(x, y); _mm256_min_epu32(s_, _mm256_sub_epi32(s_, p)); })
+#define VEC_SUB(x, y, p) ({ __m256i d_ = _mm256_sub_epi32(x, y); _mm256_min_epu32(d_, _mm256_add_epi32(d_, p)); })
+#define VEC_MONT ntt_mont_avx2
+#define NTT_TAIL(scalar_stage, is_dif, a, len, m, w, P) ntt_tail_avx2(is_dif, a, len, m, w, P)
+NTT_DEFINE_VECTOR_KERNELS(avx2, "avx2")
+#undef NTT_TAIL
+#undef VEC
+#undef LANES
+#undef VEC_SET1
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MONT
+
+// AVX-512
+__attribute__((target("avx512f"))) static inline __m512i ntt_mont_avx512(__m512i a, __m512i b, __m512i p, __m512i pinv)
+{
+    __m512i t_even = _mm512_mul_epu32(a, b), t_odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+    __m512i qp_even = _mm512_mul_epu32(_mm512_mul_epu32(t_even, pinv), p), qp_odd = _mm512_mul_epu32(_mm512_mul_epu32(t_odd, pinv), p);
+    __m512i r = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(_mm512_sub_epi64(t_even, qp_even), 32), _mm512_sub_epi64(t_odd, qp_odd));
+    return _mm512_min_epu32(r, _mm512_add_epi32(r, p));
+}
+// Tail stages on AVX-512 (m = 1, 2, 4, 8): same idea with 16 butterflies over two vectors, and permutex2var picks lanes
+// from both vectors at once, so no blends are needed.
+__attribute__((target("avx512f"))) static void ntt_tail_avx512(bool is_dif, uint32_t *a, size_t len, size_t m, const uint32_t *w, const ntt_prime_t *P)
+{
+    if (len < 32) { (is_dif ? ntt_dif_stage_scalar : ntt_dit_stage_scalar)(a, len, m, w, P); return; }
+    uint32_t gu[16], gv[16], sa[16], sb[16], wp[16];
+    for (size_t q = 0; q < 16; q++)
+    {
+        size_t u = (q / m) * 2*m + q % m;
+        gu[q] = u; gv[q] = u + m; wp[q] = w[q % m];
+    }
+    for (size_t pos = 0; pos < 32; pos++)  // each of the 32 positions takes lane q of U (index q) or of V (index 16+q)
+    {
+        uint32_t from = (pos / (2*m)) * m + pos % m + (pos % (2*m) >= m ? 16 : 0);
+        if (pos < 16) sa[pos] = from; else sb[pos-16] = from;
+    }
+    __m512i gather_u = _mm512_loadu_si512(gu), gather_v = _mm512_loadu_si512(gv);
+    __m512i scatter_a = _mm512_loadu_si512(sa), scatter_b = _mm512_loadu_si512(sb), w_pattern = _mm512_loadu_si512(wp);
+    __m512i p = _mm512_set1_epi32((int)P->p), pinv = _mm512_set1_epi32((int)P->pinv);
+    for (size_t i = 0; i < len; i += 32)
+    {
+        __m512i A = _mm512_loadu_si512(a+i), B = _mm512_loadu_si512(a+i+16);
+        __m512i U = _mm512_permutex2var_epi32(A, gather_u, B), V = _mm512_permutex2var_epi32(A, gather_v, B);
+        __m512i U2, V2;
+        if (is_dif)
+        {
+            __m512i s = _mm512_add_epi32(U, V), d = _mm512_sub_epi32(U, V);
+            U2 = _mm512_min_epu32(s, _mm512_sub_epi32(s, p));
+            V2 = ntt_mont_avx512(_mm512_min_epu32(d, _mm512_add_epi32(d, p)), w_pattern, p, pinv);
+        }
+        else
+        {
+            V = ntt_mont_avx512(V, w_pattern, p, pinv);
+            __m512i s = _mm512_add_epi32(U, V), d = _mm512_sub_epi32(U, V);
+            U2 = _mm512_min_epu32(s, _mm512_sub_epi32(s, p));
+            V2 = _mm512_min_epu32(d, _mm512_add_epi32(d, p));
+        }
+        _mm512_storeu_si512(a+i, _mm512_permutex2var_epi32(U2, scatter_a, V2));
+        _mm512_storeu_si512(a+i+16, _mm512_permutex2var_epi32(U2, scatter_b, V2));
+    }
+}
+
+#define VEC __m512i
+#define LANES 16
+#define VEC_SET1(x) _mm512_set1_epi32((int)(x))
+#define VEC_LOAD(ptr) _mm512_loadu_si512((const void *)(ptr))
+#define VEC_STORE(ptr, x) _mm512_storeu_si512((void *)(ptr), x)
+#define VEC_ADD(x, y, p) ({ __m512i s_ = _mm512_add_epi32(x, y); _mm512_min_epu32(s_, _mm512_sub_epi32(s_, p)); })
+#define VEC_SUB(x, y, p) ({ __m512i d_ = _mm512_sub_epi32(x, y); _mm512_min_epu32(d_, _mm512_add_epi32(d_, p)); })
+#define VEC_MONT ntt_mont_avx512
+#define NTT_TAIL(scalar_stage, is_dif, a, len, m, w, P) ntt_tail_avx512(is_dif, a, len, m, w, P)
+NTT_DEFINE_VECTOR_KERNELS(avx512, "avx512f")
+#undef NTT_TAIL
+#undef VEC
+#undef LANES
+#undef VEC_SET1
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_ADD
+#undef VEC_SUB
+#undef VEC_MONT
+#endif
+
+static const ntt_kernels_t *ntt_kernels = NULL;
+static pthread_once_t ntt_once = PTHREAD_ONCE_INIT;
+
+// kernels, Montgomery and Garner constants. Once only: batch ladders can make their first NTT products at the same time
+static void ntt_init_once(void)
+{
+    ntt_kernels = &ntt_kernels_scalar;
+    const char *forced = getenv("FIBO_NTT_ISA");
+    #if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (forced ? strcmp(forced, "avx512") == 0 : __builtin_cpu_supports("avx512f")) ntt_kernels = &ntt_kernels_avx512;
+        else if (forced ? strcmp(forced, "avx2") == 0 : __builtin_cpu_supports("avx2")) ntt_kernels = &ntt_kernels_avx2;
+        else if (forced ? strcmp(forced, "sse4.2") == 0 : __builtin_cpu_supports("sse4.2")) ntt_kernels = &ntt_kernels_sse42;
+    #endif
+    (void)forced;
+
+    for (int i = 0; i < 3; i++)
+    {
+        ntt_prime_t *P = &ntt_primes[i];
+        uint32_t inv = 1;
+        for (int it = 0; it < 5; it++) inv *= 2 - P->p * inv;  // Newton, doubles the correct bits each round
+        P->pinv = inv;
+        P->r1 = (uint32_t)((1ull << 32) % P->p);
+    }
+
+    // Garner: t1 = (a1-a0)/p0 mod p1, t2 = (a2-a0-p0*t1)/(p0*p1) mod p2. The divisions are Montgomery multiplications.
+    uint64_t p0 = ntt_primes[0].p, p1 = ntt_primes[1].p, p2 = ntt_primes[2].p;
+    uint64_t inv_p0p1 = ntt_pow_mod(p0 % p2 * (p1 % p2) % p2, p2 - 2, p2);
+    ntt_crt_c1 = ntt_to_mont(ntt_pow_mod(p0, p1 - 2, p1), (uint32_t)p1);
+    ntt_crt_c2a = ntt_to_mont(inv_p0p1, (uint32_t)p2);
+    ntt_crt_c2b = ntt_to_mont(p0 % p2 * inv_p0p1 % p2, (uint32_t)p2);
+}
+
+static void ntt_init(void) { pthread_once(&ntt_once, ntt_init_once); }
+
+// the twiddles of stages tw_len..len (tw_len of them are there already); stage m uses [m, 2m), whatever the length
+static void ntt_fill_twiddles(const ntt_prime_t *P, uint32_t *tw, uint32_t *itw, size_t tw_len, size_t len)
+{
+    for (size_t m = tw_len ? tw_len : 1; 2*m <= len; m *= 2)
+    {
+        if (m == 1) { tw[1] = itw[1] = P->r1; continue; }
+        // w_2m^j: even j is w_m^(j/2) from the stage below, odd j is that times w_2m. No dependency chain, so it vectorizes.
+        uint64_t w = ntt_pow_mod(P->g, (P->p - 1) / (2*m), P->p);
+        uint32_t w_mont = ntt_to_mont(w, P->p), iw_mont = ntt_to_mont(ntt_pow_mod(w, P->p - 2, P->p), P->p);
+        for (size_t j = 0; j < m; j += 2)
+        {
+            tw[m+j] = tw[m/2 + j/2];
+            itw[m+j] = itw[m/2 + j/2];
+            tw[m+j+1] = ntt_mont_mul(tw[m/2 + j/2], w_mont, P);
+            itw[m+j+1] = ntt_mont_mul(itw[m/2 + j/2], iw_mont, P);
+        }
+    }
+}
+
+// Twiddle tables only ever grow. Batch ladders multiply concurrently, so a table is never resized in place: a bigger
+// one is built beside it and swapped in under the lock, and the old one stays allocated for whoever still reads it
+// (retired, never freed; each table at least doubles, so the retired ones add up to less than the live one).
+static pthread_mutex_t ntt_tw_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t *ntt_tw_retired[3 * 2 * (NTT_LOG_MAX_LEN + 1)];
+static int ntt_n_tw_retired = 0;
+
+// tables good for transforms up to len, which stay valid for the caller
+static void ntt_ensure_twiddles(ntt_prime_t *P, size_t len, const uint32_t **tw, const uint32_t **itw)
+{
+    pthread_mutex_lock(&ntt_tw_lock);
+    if (P->tw_len < len)
+    {
+        uint32_t *new_tw = malloc(len * sizeof(uint32_t)), *new_itw = malloc(len * sizeof(uint32_t));
+        if (P->tw_len)
+        {
+            memcpy(new_tw, P->tw, P->tw_len * sizeof(uint32_t));
+            memcpy(new_itw, P->itw, P->tw_len * sizeof(uint32_t));
+            ntt_tw_retired[ntt_n_tw_retired++] = P->tw;
+            ntt_tw_retired[ntt_n_tw_retired++] = P->itw;
+        }
+        ntt_fill_twiddles(P, new_tw, new_itw, P->tw_len, len);
+        P->tw = new_tw;
+        P->itw = new_itw;
+        P->tw_len = len;
+    }
+    *tw = P->tw;
+    *itw = P->itw;
+    pthread_mutex_unlock(&ntt_tw_lock);
+}
+
+// Stages whose butterflies span more than a block sweep the whole array; once they fit, each block runs all of its
+// remaining stages while it is still in cache (DIF goes big-to-small, so the blocked part comes last; DIT the other way).
+#define NTT_BLOCK ((size_t)1 << 14)  // 64KB of residues, sits in L2
+
+static void ntt_forward(uint32_t *a, size_t len, const uint32_t *tw, const ntt_prime_t *P)
+{
+    size_t m = len / 2;
+    for (; m >= 1 && 2*m > NTT_BLOCK; m /= 2) ntt_kernels->dif_stage(a, len, m, tw + m, P);
+    size_t block = 2*m;
+    for (size_t start = 0; start < len; start += block)
+        for (size_t bm = m; bm >= 1; bm /= 2) ntt_kernels->dif_stage(a + start, block, bm, tw + bm, P);
+}
+
+static void ntt_inverse(uint32_t *a, size_t len, const uint32_t *itw, const ntt_prime_t *P)
+{
+    size_t block = len < NTT_BLOCK ? len : NTT_BLOCK;
+    for (size_t start = 0; start < len; start += block)
+        for (size_t m = 1; m < block; m *= 2) ntt_kernels->dit_stage(a + start, block, m, itw + m, P);
+    for (size_t m = block; m < len; m *= 2) ntt_kernels->dit_stage(a, len, m, itw + m, P);
+}
+
+static size_t ntt_digits(size_t limbs) { return (limbs * GMP_NUMB_BITS + NTT_DIGIT_BITS - 1) / NTT_DIGIT_BITS; }
+
+// cut |x| into digits, reduced mod p, zero-padded to len, then forward transform
+static void ntt_load_forward(uint32_t *dst, size_t len, mpz_srcptr x, const uint32_t *tw, const ntt_prime_t *P)
+{
+    size_t n = mpz_size(x), digits = ntt_digits(n);
+    const mp_limb_t *xp = mpz_limbs_read(x);
+    for (size_t i = 0; i < digits; i++)
+    {
+        size_t bit = i * NTT_DIGIT_BITS, limb = bit / GMP_NUMB_BITS;
+        unsigned shift = bit % GMP_NUMB_BITS;
+        uint64_t v = xp[limb] >> shift;
+        if (shift > GMP_NUMB_BITS - NTT_DIGIT_BITS && limb + 1 < n) v |= xp[limb+1] << (GMP_NUMB_BITS - shift);
+        dst[i] = ntt_mont_mul((uint32_t)v & NTT_DIGIT_MASK, P->r1, P);  // x * 2^32 / 2^32 = x mod p
+    }
+    memset(dst + digits, 0, (len - digits) * sizeof(uint32_t));
+    ntt_forward(dst, len, tw, P);
+}
+
+// CRT the three residue vectors back into coefficients, propagate carries and write the limbs of out.
+// After the inverse transform the values are len*c/2^32 (one Montgomery factor left over from the pointwise products),
+// so the first multiplication by len^-1 * 2^64 mod p brings them back to c.
+// The Garner digits t1, t2 (see ntt_init) come from the active kernel set, then c = a0 + p0*t1 + p0*p1*t2.
+static void ntt_store(mpz_ptr out, uint32_t *res[3], size_t len, size_t out_limbs, bool is_negative)
+{
+    const ntt_prime_t *P0 = &ntt_primes[0], *P1 = &ntt_primes[1];
+    uint32_t scale[3];
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t p = ntt_primes[i].p;
+        uint64_t r2 = ntt_to_mont(ntt_primes[i].r1, (uint32_t)p);  // 2^64 mod p
+        scale[i] = (uint32_t)(ntt_pow_mod(len, p - 2, p) * r2 % p);
+    }
+    unsigned __int128 p0p1 = (unsigned __int128)P0->p * P1->p;
+    ntt_kernels->garner(res, len, scale);
+
+    mp_limb_t *op = mpz_limbs_write(out, out_limbs);
+    memset(op, 0, out_limbs * sizeof(mp_limb_t));
+    unsigned __int128 carry = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        carry += res[0][i] + (uint64_t)P0->p * res[1][i] + p0p1 * res[2][i];
+
+        uint64_t digit = (uint64_t)carry & NTT_DIGIT_MASK;
+        carry >>= NTT_DIGIT_BITS;
+        size_t bit = i * NTT_DIGIT_BITS, limb = bit / GMP_NUMB_BITS;
+        unsigned shift = bit % GMP_NUMB_BITS;
+        if (limb >= out_limbs) continue;  // only zeros up here, the product fits in out_limbs
+        op[limb] |= digit << shift;
+        if (shift > GMP_NUMB_BITS - NTT_DIGIT_BITS && limb + 1 < out_limbs) op[limb+1] |= digit >> (GMP_NUMB_BITS - shift);
+    }
+    mpz_limbs_finish(out, is_negative ? -(mp_size_t)out_limbs : (mp_size_t)out_limbs);
+}
+
+// A batch shares forward transforms between its jobs: the doubling step's F(k)^2 and F(k+1)F(k) transform F(k) once,
+// so it costs 2 forward + 2 inverse transforms instead of 3 + 2. A job whose operand nobody else reads multiplies into
+// that operand's buffer; only jobs without one get their own.
+typedef struct {
+    mul_job_t *jobs;
+    int n_jobs, n_ops;
+    mpz_srcptr ops[8];
+    int op_a[4], op_b[4];       // which ops each job multiplies
+    uint32_t *op_buf[8][3];     // forward transform of each op, per prime
+    uint32_t *job_buf[4][3];    // where each job's product ends up
+    size_t out_limbs[4];
+    bool is_negative[4];
+    size_t len;
+    const uint32_t *tw[3], *itw[3];  // twiddles per prime, for len
+} ntt_batch_t;
+
+static void ntt_forward_task(void *ctx, size_t task)
+{
+    ntt_batch_t *b = ctx;
+    int op = task / 3, prime = task % 3;
+    ntt_load_forward(b->op_buf[op][prime], b->len, b->ops[op], b->tw[prime], &ntt_primes[prime]);
+}
+
+static void ntt_product_task(void *ctx, size_t task)
+{
+    ntt_batch_t *b = ctx;
+    int job = task / 3, prime = task % 3;
+    uint32_t *dst = b->job_buf[job][prime];
+    const uint32_t *x = b->op_buf[b->op_a[job]][prime], *y = b->op_buf[b->op_b[job]][prime];
+    if (dst == x) ntt_kernels->pointwise(dst, y, b->len, &ntt_primes[prime]);
+    else
+    {
+        if (dst != y) memcpy(dst, y, b->len * sizeof(uint32_t));
+        ntt_kernels->pointwise(dst, x, b->len, &ntt_primes[prime]);
+    }
+    ntt_inverse(dst, b->len, b->itw[prime], &ntt_primes[prime]);
+}
+
+static void ntt_store_task(void *ctx, size_t task)
+{
+    ntt_batch_t *b = ctx;
+    ntt_store(b->jobs[task].out, b->job_buf[task], b->len, b->out_limbs[task], b->is_negative[task]);
+}
+
+void ntt_mul_batch(mul_job_t *jobs, int n_jobs)
+{
+    ntt_init();
+
+    // the NTT takes the big jobs, GMP the rest
+    mul_job_t ntt_jobs[4], gmp_jobs[n_jobs];
+    int n_ntt = 0, n_gmp = 0;
+    for (int i = 0; i < n_jobs; i++)
+    {
+        size_t an = mpz_size(jobs[i].a), bn = mpz_size(jobs[i].b);
+        bool is_ntt = n_ntt < 4 && an >= NTT_MIN_LIMBS && bn >= NTT_MIN_LIMBS / 4
+                   && ntt_digits(an) + ntt_digits(bn) <= ((size_t)1 << NTT_LOG_MAX_LEN);
+        if (is_ntt) ntt_jobs[n_ntt++] = jobs[i]; else gmp_jobs[n_gmp++] = jobs[i];
+    }
+    if (n_gmp) gmp_mul_batch(gmp_jobs, n_gmp);
+    if (!n_ntt) return;
+
+    ntt_batch_t b = { .jobs = ntt_jobs, .n_jobs = n_ntt, .len = 1 };
+    for (int j = 0; j < n_ntt; j++)
+    {
+        int *slots[2] = { &b.op_a[j], &b.op_b[j] };
+        mpz_srcptr xs[2] = { ntt_jobs[j].a, ntt_jobs[j].b };
+        for (int s = 0; s < 2; s++)
+        {
+            int op = 0;
+            while (op < b.n_ops && b.ops[op] != xs[s]) op++;
+            if (op == b.n_ops) b.ops[b.n_ops++] = xs[s];
+            *slots[s] = op;
+        }
+        size_t needed = ntt_digits(mpz_size(xs[0])) + ntt_digits(mpz_size(xs[1]));
+        while (b.len < needed) b.len *= 2;
+        b.out_limbs[j] = mpz_size(xs[0]) + mpz_size(xs[1]);  // taken now, an output may well be another job's input
+        b.is_negative[j] = (mpz_sgn(xs[0]) < 0) != (mpz_sgn(xs[1]) < 0);
+    }
+    for (int i = 0; i < 3; i++) ntt_ensure_twiddles(&ntt_primes[i], b.len, &b.tw[i], &b.itw[i]);
+
+    // buffers come from GMP's allocator, so --mem-stats sees them too
+    void *(*alloc_fn)(size_t);
+    void (*free_fn)(void *, size_t);
+    mp_get_memory_functions(&alloc_fn, NULL, &free_fn);
+
+    int op_users[8] = { 0 };
+    for (int j = 0; j < n_ntt; j++) { op_users[b.op_a[j]]++; if (b.op_b[j] != b.op_a[j]) op_users[b.op_b[j]]++; }
+    int n_bufs = b.n_ops;
+    for (int j = 0; j < n_ntt; j++) if (op_users[b.op_a[j]] > 1 && op_users[b.op_b[j]] > 1) n_bufs++;
+    size_t buf_bytes = b.len * sizeof(uint32_t), total_bytes = 3 * n_bufs * buf_bytes;
+    uint32_t *arena = alloc_fn(total_bytes);
+
+    int next_buf = 0;
+    for (int op = 0; op < b.n_ops; op++, next_buf++)
+        for (int prime = 0; prime < 3; prime++) b.op_buf[op][prime] = arena + (3 * next_buf + prime) * b.len;
+    for (int j = 0; j < n_ntt; j++)
+    {
+        int own = op_users[b.op_a[j]] == 1 ? b.op_a[j] : op_users[b.op_b[j]] == 1 ? b.op_b[j] : -1;
+        for (int prime = 0; prime < 3; prime++)
+            b.job_buf[j][prime] = own >= 0 ? b.op_buf[own][prime] : arena + (3 * next_buf + prime) * b.len;
+        if (own < 0) next_buf++;
+    }
+
+    pool_run(fib_pool, ntt_forward_task, &b, 3 * b.n_ops);
+    pool_run(fib_pool, ntt_product_task, &b, 3 * n_ntt);
+    pool_run(fib_pool, ntt_store_task, &b, n_ntt);
+
+    free_fn(arena, total_bytes);
+}
+
+
+// Multiplication backends (--mul). Each takes a whole batch of independent products, so it can share work between them.
+typedef struct {
+    const char *name;
+    void (*mul_batch)(mul_job_t *jobs, int n_jobs);
+} mul_backend_t;
+
+static const mul_backend_t mul_backends[] = {
+    { "gmp", gmp_mul_batch },
+    { "ntt", ntt_mul_batch },
+};
+
+static const mul_backend_t *fib_mul_backend = &mul_backends[0];
+
+void fib_mul_batch(mul_job_t *jobs, int n_jobs) { fib_mul_backend->mul_batch(jobs, n_jobs); }
+
+void fib_mul(mpz_ptr out, mpz_srcptr a, mpz_srcptr b)
+{
+    mul_job_t job = { out, a, b };
+    fib_mul_batch(&job, 1);
+}
+
+
+// Result output (--format). GMP's printf builds the whole decimal string first, then stdio copies it once more on the way out.
+// Here the number is cut into fixed-width decimal segments by divide and conquer over cached powers of 10 (the splits of a
+// level run in parallel), the segments are converted a window at a time on the pool, and every finished window goes straight
+// to stdout with write(). Only a window of digits is ever held as text.
+#define OUT_MIN_SEGMENT_DIGITS ((size_t)1 << 16)  // out_pows[0] is 10^this
+#define OUT_MAX_SEGMENT_DIGITS ((size_t)1 << 20)  // bounds the text kept per thread
+#define OUT_CHUNK_BYTES ((size_t)1 << 20)
+#define OUT_MAX_POWS 40
+
+static mpz_t out_pows[OUT_MAX_POWS];  // out_pows[i] = 10^(OUT_MIN_SEGMENT_DIGITS * 2^i), squared up on demand and kept
+static int out_n_pows = 0;
+
+static mpz_srcptr out_pow(int i)
+{
+    for (; out_n_pows <= i; out_n_pows++)
+    {
+        mpz_init(out_pows[out_n_pows]);
+        if (out_n_pows == 0) mpz_ui_pow_ui(out_pows[0], 10, OUT_MIN_SEGMENT_DIGITS);
+        else fib_mul(out_pows[out_n_pows], out_pows[out_n_pows-1], out_pows[out_n_pows-1]);
+    }
+    return out_pows[i];
+}
+
+static void out_write_all(const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, buf, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0)
+        {
+            fprintf(stderr, "Failed to write the result: %s\n", strerror(errno));
+            exit(1);
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+}
+
+static char *out_alloc_buffer(size_t size)
+{
+    void *buf;
+    if (posix_memalign(&buf, 4096, size) != 0) mem_out_of_memory(size);
+    return buf;
+}
+
+// Segment i of n covers the digits [i*width, (i+1)*width) counted from the top; slot[first] holds a run of n_segs segments
+// until it's split into its upper part (stays at first) and its lower h segments (moves to first + n_segs - h).
+typedef struct {
+    mpz_srcptr x;
+    mpz_t *slots;
+    size_t *n_segs;
+    size_t n, width;
+    int width_pow;            // width == OUT_MIN_SEGMENT_DIGITS << width_pow
+    size_t *split_first;      // this round's runs
+    char **bufs;              // conversion window
+    size_t *buf_len;
+    size_t window_first;
+} out_decimal_t;
+
+static int out_floor_log2(size_t v) { return 63 - __builtin_clzll(v); }
+
+static void out_split_task(void *ctx, size_t task)
+{
+    out_decimal_t *d = ctx;
+    size_t first = d->split_first[task], n_segs = d->n_segs[first];
+    int log_h = out_floor_log2(n_segs - 1);
+    size_t h = (size_t)1 << log_h;
+    mpz_srcptr src = (first == 0 && n_segs == d->n) ? d->x : d->slots[first];  // the top run starts out as x itself
+    mpz_tdiv_qr(d->slots[first], d->slots[first + n_segs - h], src, out_pows[d->width_pow + log_h]);
+    d->n_segs[first] = n_segs - h;
+    d->n_segs[first + n_segs - h] = h;
+}
+
+static void out_convert_task(void *ctx, size_t task)
+{
+    out_decimal_t *d = ctx;
+    size_t seg = d->window_first + task;
+    char *buf = d->bufs[task];
+    mpz_srcptr value = d->n == 1 ? d->x : d->slots[seg];
+    size_t len = 0;
+    if (seg > 0 || mpz_sgn(value) != 0 || d->n == 1)  // sizeinbase's overshoot can leave the top segment empty
+    {
+        mpz_get_str(buf, 10, value);
+        len = strlen(buf);
+    }
+    if (seg > 0 && len < d->width)  // inner segments keep their leading zeros
+    {
+        memmove(buf + d->width - len, buf, len);
+        memset(buf, '0', d->width - len);
+        len = d->width;
+    }
+    if (seg == d->n - 1) buf[len++] = '\n';
+    d->buf_len[task] = len;
+}
+
+static void out_decimal(mpz_srcptr x)
+{
+    out_decimal_t d = { .x = x };
+    int threads = pool_threads();
+    size_t digits = mpz_sizeinbase(x, 10);  // may be one too many, which only costs an empty top segment in the worst case
+
+    // segment width: enough segments to keep every thread busy, but not so small that the splitting dominates
+    d.width_pow = 0;
+    while ((OUT_MIN_SEGMENT_DIGITS << d.width_pow) < OUT_MAX_SEGMENT_DIGITS && (OUT_MIN_SEGMENT_DIGITS << d.width_pow) * 4 * threads < digits) d.width_pow++;
+    d.width = OUT_MIN_SEGMENT_DIGITS << d.width_pow;
+    d.n = digits <= d.width ? 1 : (digits + d.width - 1) / d.width;
+
+    if (d.n > 1)
+    {
+        out_pow(d.width_pow + out_floor_log2(d.n - 1));
+        d.slots = malloc(d.n * sizeof(mpz_t));
+        d.n_segs = calloc(d.n, sizeof(size_t));
+        d.split_first = malloc(d.n * sizeof(size_t));
+        for (size_t i = 0; i < d.n; i++) mpz_init(d.slots[i]);
+        d.n_segs[0] = d.n;
+
+        for (;;)  // one level of the division tree per round
+        {
+            size_t n_splits = 0;
+            for (size_t i = 0; i < d.n; i++) if (d.n_segs[i] > 1) d.split_first[n_splits++] = i;
+            if (n_splits == 0) break;
+            pool_run(fib_pool, out_split_task, &d, n_splits);
+        }
+    }
+
+    size_t window = (size_t)threads < d.n ? (size_t)threads : d.n;
+    char *bufs[window];
+    size_t buf_len[window];
+    for (size_t i = 0; i < window; i++) bufs[i] = out_alloc_buffer(d.width + 2);  // digits, '\n' or get_str's NUL, and a spare for sizeinbase's overshoot
+    d.bufs = bufs;
+    d.buf_len = buf_len;
+
+    fflush(stdout);  // nothing buffered may end up behind the digits
+    for (d.window_first = 0; d.window_first < d.n; d.window_first += window)
+    {
+        size_t n_tasks = d.n - d.window_first < window ? d.n - d.window_first : window;
+        pool_run(fib_pool, out_convert_task, &d, n_tasks);
+        for (size_t i = 0; i < n_tasks; i++) out_write_all(bufs[i], buf_len[i]);
+    }
+
+    for (size_t i = 0; i < window; i++) free(bufs[i]);
+    if (d.n > 1)
+    {
+        for (size_t i = 0; i < d.n; i++) mpz_clear(d.slots[i]);
+        free(d.slots);
+        free(d.n_segs);
+        free(d.split_first);
+    }
+}
+
+// hex needs no arithmetic: stream the limbs from the top, 16 digits each
+static void out_hex(mpz_srcptr x)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    char *buf = out_alloc_buffer(OUT_CHUNK_BYTES);
+    size_t len = 0, n_limbs = mpz_size(x);
+    const mp_limb_t *limbs = mpz_limbs_read(x);
+
+    if (n_limbs == 0) buf[len++] = '0';
+    int shift = n_limbs ? (out_floor_log2(limbs[n_limbs-1]) & ~3) : 0;  // first digit of the top limb, no leading zeros
+    fflush(stdout);
+    for (size_t i = n_limbs; i-- > 0; shift = GMP_LIMB_BITS - 4)
+    {
+        if (len + GMP_LIMB_BITS / 4 + 1 > OUT_CHUNK_BYTES) out_write_all(buf, len), len = 0;
+        for (int s = shift; s >= 0; s -= 4) buf[len++] = hex_digits[(limbs[i] >> s) & 15];
+    }
+    buf[len++] = '\n';
+    out_write_all(buf, len);
+    free(buf);
+}
+
+// raw: the magnitude's bytes, least significant first, nothing else
+static void out_raw(mpz_srcptr x)
+{
+    size_t n_bytes = mpz_sgn(x) ? (mpz_sizeinbase(x, 2) + 7) / 8 : 0;
+    fflush(stdout);
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        out_write_all((const char *)mpz_limbs_read(x), n_bytes);  // the limbs are already laid out that way
+    #else
+        char *buf = out_alloc_buffer(n_bytes + 1);
+        mpz_export(buf, NULL, -1, 1, 0, 0, x);
+        out_write_all(buf, n_bytes);
+        free(buf);
+    #endif
+}
+
+void fib_print(mpz_srcptr x)
+{
+    switch (fib_opts.format)
+    {
+        case OUT_HEX: out_hex(x); break;
+        case OUT_RAW: out_raw(x); break;
+        default:      out_decimal(x); break;
+    }
+}
+
+
+static double fib_bits(uint64_t k) { return 0.6942419136306174 * (double)k + 1; }  // log2(phi) bits per index
+
+
+// Small indices skip mpz altogether. Up to F(186) (the last below 2^128) it's a table lookup printed by hand; from there up to
+// FIB_STACK_LIMBS limbs the doubling ladder runs on fixed-size stack arrays through GMP's mpn layer, which doesn't allocate at
+// these sizes. Only the default engine and auto take these shortcuts: an engine named with --algo always runs as itself, so
+// timing it (compare_runtime.sh, --bench) times that engine.
+#define FIB_SMALL_MAX 186
+#define FIB_STACK_LIMBS 64  // 4096 bits, up to F(5890) or so. Measured: around there lucas' cheaper last step starts to win
+
+// F(0)..F(186), generated by a few lines of Python. A constant, so batch workers can all read it from the start.
+#define U128(hi, lo) ((unsigned __int128)(hi) << 64 | (lo))
+static const unsigned __int128 fib_small_table[FIB_SMALL_MAX + 1] = {
+    0x0, 0x1, 0x1, 0x2, 0x3, 0x5, 0x8, 0xd, 0x15, 0x22, 0x37, 0x59, 0x90, 0xe9, 0x179, 0x262, 0x3db, 0x63d, 0xa18,
+    0x1055, 0x1a6d, 0x2ac2, 0x452f, 0x6ff1, 0xb520, 0x12511, 0x1da31, 0x2ff42, 0x4d973, 0x7d8b5, 0xcb228, 0x148add,
+    0x213d05, 0x35c7e2, 0x5704e7, 0x8cccc9, 0xe3d1b0, 0x1709e79, 0x2547029, 0x3c50ea2, 0x6197ecb, 0x9de8d6d, 0xff80c38,
+    0x19d699a5, 0x29cea5dd, 0x43a53f82, 0x6d73e55f, 0xb11924e1, 0x11e8d0a40, 0x1cfa62f21, 0x2ee333961, 0x4bdd96882,
+    0x7ac0ca1e3, 0xc69e60a65, 0x1415f2ac48, 0x207fd8b6ad, 0x3495cb62f5, 0x5515a419a2, 0x89ab6f7c97, 0xdec1139639,
+    0x1686c8312d0, 0x2472d96a909, 0x3af9a19bbd9, 0x5f6c7b064e2, 0x9a661ca20bb, 0xf9d297a859d, 0x19438b44a658,
+    0x28e0b4bf2bf5, 0x42244003d24d, 0x6b04f4c2fe42, 0xad2934c6d08f, 0x1182e2989ced1, 0x1c5575e509f60, 0x2dd8587da6e31,
+    0x4a2dce62b0d91, 0x780626e057bc2, 0xc233f54308953, 0x13a3a1c2360515, 0x1fc6e116668e68, 0x336a82d89c937d,
+    0x533163ef0321e5, 0x869be6c79fb562, 0xd9cd4ab6a2d747, 0x16069317e428ca9, 0x23a367c34e563f0, 0x39a9fadb327f099,
+    0x5d4d629e80d5489, 0x96f75d79b354522, 0xf444c01834299ab, 0x18b3c1d91e77decd, 0x27f80ddaa1ba7878, 0x40abcfb3c0325745,
+    0x68a3dd8e61eccfbd, 0xa94fad42221f2702, U128(0x1, 0x11f38ad0840bf6bf), U128(0x1, 0xbb433812a62b1dc1),
+    U128(0x2, 0xcd36c2e32a371480), U128(0x4, 0x8879faf5d0623241), U128(0x7, 0x55b0bdd8fa9946c1),
+    U128(0xb, 0xde2ab8cecafb7902), U128(0x13, 0x33db76a7c594bfc3), U128(0x1f, 0x12062f76909038c5),
+    U128(0x32, 0x45e1a61e5624f888), U128(0x51, 0x57e7d594e6b5314d), U128(0x83, 0x9dc97bb33cda29d5),
+    U128(0xd4, 0xf5b15148238f5b22), U128(0x158, 0x937accfb606984f7), U128(0x22d, 0x892c1e4383f8e019),
+    U128(0x386, 0x1ca6eb3ee4626510), U128(0x5b3, 0xa5d30982685b4529), U128(0x939, 0xc279f4c14cbdaa39),
+    U128(0xeed, 0x684cfe43b518ef62), U128(0x1827, 0x2ac6f30501d6999b), U128(0x2714, 0x9313f148b6ef88fd),
+    U128(0x3f3b, 0xbddae44db8c62298), U128(0x6650, 0x50eed5966fb5ab95), U128(0xa58c, 0xec9b9e4287bce2d),
+    U128(0x10bdc, 0x5fb88f7a983179c2), U128(0x1b168, 0x6e82495ec0ad47ef), U128(0x2bd44, 0xce3ad8d958dec1b1),
+    U128(0x46ead, 0x3cbd2238198c09a0), U128(0x72bf2, 0xaf7fb11726acb51), U128(0xb9a9f, 0x47b51d498bf6d4f1),
+    U128(0x12c691, 0x52ad185afe61a042), U128(0x1e6130, 0x9a6235a48a587533), U128(0x3127c1, 0xed0f4dff88ba1575),
+    U128(0x4f88f2, 0x877183a413128aa8), U128(0x80b0b4, 0x7480d1a39bcca01d), U128(0xd039a6, 0xfbf25547aedf2ac5),
+    U128(0x150ea5b, 0x707326eb4aabcae2), U128(0x2212402, 0x6c657c32f98af5a7), U128(0x3720e5d, 0xdcd8a31e4436c089),
+    U128(0x5933260, 0x493e1f513dc1b630), U128(0x90540be, 0x2616c26f81f876b9), U128(0xe98731e, 0x6f54e1c0bfba2ce9),
+    U128(0x179db3dc, 0x956ba43041b2a3a2), U128(0x263626fb, 0x4c085f1016cd08b), U128(0x3dd3dad7, 0x9a2c2a21431f742d),
+    U128(0x640a01d2, 0x9eecb012448c44b8), U128(0xa1dddcaa, 0x3918da3387abb8e5), U128(0x105e7de7c, 0xd8058a45cc37fd9d),
+    U128(0x1a7c5bb27, 0x111e647953e3b682), U128(0x2adad99a3, 0xe923eebf201bb41f), U128(0x4557354ca, 0xfa42533873ff6aa1),
+    U128(0x70320ee6e, 0xe36641f7941b1ec0), U128(0xb58944339, 0xdda89530081a8961),
+    U128(0x125bb531a8, 0xc10ed7279c35a821), U128(0x1db44974e2, 0x9eb76c57a4503182),
+    U128(0x300ffea68b, 0x5fc6437f4085d9a3), U128(0x4dc4481b6d, 0xfe7dafd6e4d60b25),
+    U128(0x7dd446c1f9, 0x5e43f356255be4c8), U128(0xcb988edd67, 0x5cc1a32d0a31efed),
+    U128(0x1496cd59f60, 0xbb0596832f8dd4b5), U128(0x21505647cc8, 0x17c739b039bfc4a2),
+    U128(0x35e723a1c28, 0xd2ccd033694d9957), U128(0x573779e98f0, 0xea9409e3a30d5df9),
+    U128(0x8d1e9d8b519, 0xbd60da170c5af750), U128(0xe4561774e0a, 0xa7f4e3faaf685549),
+    U128(0x17174b500324, 0x6555be11bbc34c99), U128(0x255cacc7512f, 0xd4aa20c6b2ba1e2),
+    U128(0x3c73f8175453, 0x72a0601e26eeee7b), U128(0x61d0a4dea582, 0x7feb022a921a905d),
+    U128(0x9e449cf5f9d5, 0xf28b6248b9097ed8), U128(0x1001541d49f58, 0x727664734b240f35),
+    U128(0x19e59deca992e, 0x6501c6bc042d8e0d), U128(0x29e6f209f3886, 0xd7782b2f4f519d42),
+    U128(0x43cc8ff69d1b5, 0x3c79f1eb537f2b4f), U128(0x6db3820090a3c, 0x13f21d1aa2d0c891),
+    U128(0xb18011f72dbf1, 0x506c0f05f64ff3e0), U128(0x11f3393f7be62d, 0x645e2c209920bc71),
+    U128(0x1d0b3a5eeec21e, 0xb4ca3b268f70b051), U128(0x2efe739e6aa84c, 0x1928674728916cc2),
+    U128(0x4c09adfd596a6a, 0xcdf2a26db8021d13), U128(0x7b08219bc412b6, 0xe71b09b4e09389d5),
+    U128(0xc711cf991d7d21, 0xb50dac229895a6e8), U128(0x14219f134e18fd8, 0x9c28b5d7792930bd),
+    U128(0x2092bc0cdff0cfa, 0x513661fa11bed7a5), U128(0x34b45b202e09cd2, 0xed5f17d18ae80862),
+    U128(0x5547172d0dfa9cd, 0x3e9579cb9ca6e007), U128(0x89fb724d3c046a0, 0x2bf4919d278ee869),
+    U128(0xdf42897a49ff06d, 0x6a8a0b68c435c870), U128(0x1693dfbc7860370d, 0x967e9d05ebc4b0d9),
+    U128(0x248808541d00277b, 0x108a86eaffa7949), U128(0x3b1be81095605e88, 0x978745749bbf2a22),
+    U128(0x5fa3f064b2608603, 0x988fede34bb9a36b), U128(0x9abfd87547c0e48c, 0x30173357e778cd8d),
+    U128(0xfa63c8d9fa216a8f, 0xc8a7213b333270f8)
+};
+#undef U128
+
+static unsigned __int128 fib_small(uint64_t n) { return fib_small_table[n]; }
+
+// decimal, hex or raw, like fib_print()
+void fib_print_u128(unsigned __int128 v)
+{
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char buf[48];
+    char *p = buf + sizeof(buf);
+    size_t len;
+
+    if (fib_opts.format == OUT_RAW)
+    {
+        for (len = 0; v; v >>= 8) buf[len++] = (char)(v & 0xff);
+        p = buf;
+    }
+    else
+    {
+        *--p = '\n';
+        if (fib_opts.format == OUT_HEX)
+            do { *--p = "0123456789abcdef"[v & 15]; v >>= 4; } while (v);
+        else
+        {
+            while (v >= 100)  // two digits per division; the compiler turns /100 on 128 bits into a call, still far below mpz
+            {
+                unsigned pair = (unsigned)(v % 100);
+                v /= 100;
+                p -= 2;
+                memcpy(p, digit_pairs + 2 * pair, 2);
+            }
+            if (v >= 10) { p -= 2; memcpy(p, digit_pairs + 2 * (unsigned)v, 2); }
+            else *--p = (char)('0' + (unsigned)v);
+        }
+        len = (size_t)(buf + sizeof(buf) - p);
+    }
+    fflush(stdout);
+    out_write_all(p, len);
+}
+
+// r = a + b, sizes in limbs, returns the size of r
+static mp_size_t stack_add(mp_limb_t *r, const mp_limb_t *a, mp_size_t an, const mp_limb_t *b, mp_size_t bn)
+{
+    if (an < bn) { const mp_limb_t *t = a; a = b; b = t; mp_size_t tn = an; an = bn; bn = tn; }
+    r[an] = bn ? mpn_add(r, a, an, b, bn) : (mpn_copyi(r, a, an), 0);
+    return an + (r[an] != 0);
+}
+
+// r = a - b, with a >= b
+static mp_size_t stack_sub(mp_limb_t *r, const mp_limb_t *a, mp_size_t an, const mp_limb_t *b, mp_size_t bn)
+{
+    mpn_sub(r, a, an, b, bn);
+    while (an > 0 && r[an-1] == 0) an--;
+    return an;
+}
+
+static mp_size_t stack_add_sign(mp_limb_t *r, mp_size_t rn, bool is_plus)  // r +-= 1, r > 1
+{
+    if (is_plus) { r[rn] = mpn_add_1(r, r, rn, 1); return rn + (r[rn] != 0); }
+    mpn_sub_1(r, r, rn, 1);
+    return rn - (r[rn-1] == 0);
+}
+
+static bool fib_stack_fits(uint64_t n) { return fib_bits(n + 1) + 2 < FIB_STACK_LIMBS * GMP_NUMB_BITS; }
+
+// the adv ladder (see fib_ladder_double) on stack arrays, starting from (F(1), F(2)) below n's top bit
+void fib_stack(uint64_t n, bool is_printing)
+{
+    mp_limb_t fk[FIB_STACK_LIMBS + 1] = { 1 }, fk1[FIB_STACK_LIMBS + 1] = { 1 };
+    mp_limb_t ffk[2 * FIB_STACK_LIMBS + 2], fk1k[2 * FIB_STACK_LIMBS + 2], ffk1[2 * FIB_STACK_LIMBS + 2], twofk1k[2 * FIB_STACK_LIMBS + 2];
+    mp_size_t nk = 1, nk1 = 1;
+    uint64_t k = 1;
+
+    for (int bit = 62 - __builtin_clzll(n); bit >= 0; bit--)
+    {
+        bool is_bit_set = (n >> bit) & 1;
+        mpn_sqr(ffk, fk, nk);                                       // F(k)^2
+        mp_size_t nffk = 2*nk - (ffk[2*nk-1] == 0);
+        mpn_mul(fk1k, fk1, nk1, fk, nk);                            // F(k+1)F(k), nk1 >= nk
+        mp_size_t nfk1k = nk1 + nk - (fk1k[nk1+nk-1] == 0);
+        mp_size_t nffk1 = stack_add(ffk1, fk1k, nfk1k, ffk, nffk);
+        nffk1 = stack_add_sign(ffk1, nffk1, !(k & 1));               // F(k+1)^2 = F(k+1)F(k) + F(k)^2 + (-1)^k
+        twofk1k[nfk1k] = mpn_lshift(twofk1k, fk1k, nfk1k, 1);
+        mp_size_t ntwofk1k = nfk1k + (twofk1k[nfk1k] != 0);
+
+        if (is_bit_set)
+        {
+            nk = stack_add(fk, ffk1, nffk1, ffk, nffk);             // F(2k+1) = F(k+1)^2 + F(k)^2
+            nk1 = stack_add(fk1, ffk1, nffk1, twofk1k, ntwofk1k);   // F(2k+2) = F(k+1)^2 + 2F(k+1)F(k)
+        }
+        else
+        {
+            nk = stack_sub(fk, twofk1k, ntwofk1k, ffk, nffk);       // F(2k) = 2F(k+1)F(k) - F(k)^2
+            nk1 = stack_add(fk1, ffk1, nffk1, ffk, nffk);           // F(2k+1)
+        }
+        k = 2*k + is_bit_set;
+    }
+
+    if (is_printing)
+    {
+        mpz_t view;
+        fib_print(mpz_roinit_n(view, fk, nk));
+    }
+}
+
+
+// Working set shared by the ladder-walking algorithms (adv, surpass): the pair (F(k), F(k+1)) plus the scratch values a step needs
+typedef struct {
+    mpz_t fk, fk1;                                  // F(k), F(k+1)
+    mpz_t fk1k, twofk1k, ffk, ffk1, f2k1;           // scratch, named after what a doubling step keeps in them
+    uint64_t k;                                     // index we're currently at
+} fib_ladder_t;
+
+// With --prealloc, every value gets room for the largest thing a step can put in it: a product of two operands whose
+// limb counts add up to slightly more than F(n_goal+1)'s. mpz_swap only trades buffers, so they all stay that size.
+void fib_init_for(mpz_t x, uint64_t n_goal)
+{
+    if (fib_opts.is_prealloc) mpz_init2(x, (mp_bitcnt_t)fib_bits(n_goal + 1) + 4 * GMP_NUMB_BITS);
+    else mpz_init(x);
+}
+
+void fib_ladder_init(fib_ladder_t *l, uint64_t n_goal)
+{
+    fib_init_for(l->fk, n_goal);     mpz_set_ui(l->fk, 0);   // F(0)  // never printed, we start climbing from here
+    fib_init_for(l->fk1, n_goal);    mpz_set_ui(l->fk1, 1);  // F(1)
+    fib_init_for(l->fk1k, n_goal);
+    fib_init_for(l->twofk1k, n_goal);
+    fib_init_for(l->ffk, n_goal);
+    fib_init_for(l->ffk1, n_goal);
+    fib_init_for(l->f2k1, n_goal);
+    l->k = 0;
+}
+
+void fib_ladder_clear(fib_ladder_t *l)
+{
+    mpz_clear(l->fk);
+    mpz_clear(l->fk1);
+    mpz_clear(l->fk1k);
+    mpz_clear(l->twofk1k);
+    mpz_clear(l->ffk);
+    mpz_clear(l->ffk1);
+    mpz_clear(l->f2k1);
+}
+
+
+// Checkpoint cache (--cache <file>). Ladders that pass an anchor index (a power of 2 or of 3) append its F(k), and F(k+1)
+// when the step had it, to a file of raw limbs. The next run maps that file read-only and resumes from the closest anchor its
+// own ladder passes through instead of from F(0), so compare_runtime.sh's n, 3n, 9n... each cost one step more than the last.
+// Layout: header, then records that are each followed by their limbs. Everything is 8-byte aligned so the limbs can be read
+// in place. A header from another version or limb size drops the whole file. Opening walks the records by their limb counts
+// only, up to the first one that doesn't fit in the file (a short write); new records are appended there, cutting off that
+// tail. Checksums are checked one record at a time, on first lookup: a record that fails is skipped, and the records
+// around it are still used (a bad limb count makes the ones after it fail too).
+#define FIB_CACHE_MAGIC 0x54504b434f424946ull  // "FIBOCKPT"
+#define FIB_CACHE_VERSION 1
+#define FIB_CACHE_MIN_INDEX 1024               // smaller anchors are cheaper to recalculate than to look up
+#define FIB_CACHE_MAX_ENTRIES 256
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t limb_bits;
+    uint64_t sum;       // over the fields above
+    uint64_t reserved;
+} fib_cache_header_t;
+
+typedef struct {
+    uint64_t k;
+    uint64_t fk_limbs, fk1_limbs;  // fk1_limbs is 0 when only F(k) was known
+    uint64_t sum;                  // over k, the limb counts and all the limbs
+} fib_cache_record_t;
+
+typedef struct {
+    uint64_t k;
+    const fib_cache_record_t *rec;  // NULL for anchors written by this run, which only need to be remembered as present
+    int8_t status;                  // 0 unchecked, 1 checksum fine, -1 corrupt
+} fib_cache_entry_t;
+
+static struct {
+    int fd;
+    const char *map;
+    size_t map_size, valid_bytes;  // valid_bytes: where the next record goes
+    fib_cache_entry_t entries[FIB_CACHE_MAX_ENTRIES];
+    int n_entries;
+    pthread_mutex_t lock;  // batch ladders run side by side with --threads; the map itself is read-only
+} fib_cache = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t fib_cache_sum(uint64_t h, const void *words, size_t n_words)
+{
+    const uint64_t *w = words;
+    for (size_t i = 0; i < n_words; i++) h = (h ^ w[i]) * 0x100000001b3ull;  // FNV-1a, a word at a time
+    return h;
+}
+
+static bool fib_cache_is_anchor(uint64_t k)
+{
+    return k >= FIB_CACHE_MIN_INDEX && ((k & (k - 1)) == 0 || 12157665459056928801ull % k == 0);  // that's 3^40, the largest power of 3 in 64 bits
+}
+
+static uint64_t fib_cache_record_sum(const fib_cache_record_t *rec, const mp_limb_t *fk, const mp_limb_t *fk1)
+{
+    uint64_t h = fib_cache_sum(0xcbf29ce484222325ull, rec, 3);
+    h = fib_cache_sum(h, fk, rec->fk_limbs);
+    return fib_cache_sum(h, fk1, rec->fk1_limbs);
+}
+
+void fib_cache_open(const char *path)
+{
+    fib_cache.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fib_cache.fd < 0)
+    {
+        fprintf(stderr, "Can't open the cache file %s (%s), running without it\n", path, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fib_cache.fd, &st) != 0 || (size_t)st.st_size < sizeof(fib_cache_header_t)) return;  // new (or useless) file
+    fib_cache.map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, fib_cache.map_size, PROT_READ, MAP_PRIVATE, fib_cache.fd, 0);
+    if (map == MAP_FAILED) { fib_cache.map_size = 0; return; }
+    fib_cache.map = map;
+
+    const fib_cache_header_t *header = map;
+    if (header->magic != FIB_CACHE_MAGIC || header->version != FIB_CACHE_VERSION || header->limb_bits != GMP_NUMB_BITS
+        || header->sum != fib_cache_sum(0xcbf29ce484222325ull, header, 2))
+        return;  // stale, valid_bytes stays 0 so the file gets rewritten
+
+    // index the records. Only their sizes are trusted here; checksums are checked when one is about to be used
+    size_t offset = sizeof(fib_cache_header_t);
+    while (offset + sizeof(fib_cache_record_t) <= fib_cache.map_size && fib_cache.n_entries < FIB_CACHE_MAX_ENTRIES)
+    {
+        const fib_cache_record_t *rec = (const fib_cache_record_t *)(fib_cache.map + offset);
+        size_t room = (fib_cache.map_size - offset - sizeof(fib_cache_record_t)) / sizeof(mp_limb_t);
+        if (rec->fk_limbs == 0 || rec->fk_limbs > room || rec->fk1_limbs > room - rec->fk_limbs) break;  // cut short
+        fib_cache.entries[fib_cache.n_entries++] = (fib_cache_entry_t){ rec->k, rec, 0 };
+        offset += sizeof(fib_cache_record_t) + (rec->fk_limbs + rec->fk1_limbs) * sizeof(mp_limb_t);
+    }
+    fib_cache.valid_bytes = offset;
+}
+
+void fib_cache_close(void)
+{
+    if (fib_cache.map) munmap((void *)fib_cache.map, fib_cache.map_size);
+    if (fib_cache.fd >= 0) close(fib_cache.fd);
+}
+
+// a checked record for F(k) (and F(k+1) if is_pair_needed), or NULL
+static const fib_cache_record_t *fib_cache_find_locked(uint64_t k, bool is_pair_needed)
+{
+    for (int i = 0; i < fib_cache.n_entries; i++)
+    {
+        fib_cache_entry_t *e = &fib_cache.entries[i];
+        if (e->k != k || !e->rec || (is_pair_needed && e->rec->fk1_limbs == 0)) continue;
+        if (e->status == 0)
+        {
+            const mp_limb_t *limbs = (const mp_limb_t *)(e->rec + 1);
+            e->status = fib_cache_record_sum(e->rec, limbs, limbs + e->rec->fk_limbs) == e->rec->sum ? 1 : -1;
+        }
+        if (e->status > 0) return e->rec;
+    }
+    return NULL;
+}
+
+static const fib_cache_record_t *fib_cache_find(uint64_t k, bool is_pair_needed)
+{
+    pthread_mutex_lock(&fib_cache.lock);
+    const fib_cache_record_t *rec = fib_cache_find_locked(k, is_pair_needed);
+    pthread_mutex_unlock(&fib_cache.lock);
+    return rec;
+}
+
+// puts the cached F(k) (and F(k+1) when the record has it) in the ladder
+void fib_cache_load(fib_ladder_t *l, const fib_cache_record_t *rec)
+{
+    const mp_limb_t *limbs = (const mp_limb_t *)(rec + 1);
+    mpz_t view;
+    mpz_set(l->fk, mpz_roinit_n(view, limbs, (mp_size_t)rec->fk_limbs));
+    if (rec->fk1_limbs) mpz_set(l->fk1, mpz_roinit_n(view, limbs + rec->fk_limbs, (mp_size_t)rec->fk1_limbs));
+    l->k = rec->k;
+}
+
+static void fib_cache_append_locked(const fib_ladder_t *l, bool is_pair)
+{
+    if (fib_cache.fd < 0 || fib_cache.n_entries >= FIB_CACHE_MAX_ENTRIES) return;
+    for (int i = 0; i < fib_cache.n_entries; i++)
+    {
+        const fib_cache_entry_t *e = &fib_cache.entries[i];
+        if (e->k == l->k && e->status >= 0 && (!e->rec || e->rec->fk1_limbs || !is_pair)) return;  // nothing new to add
+    }
+
+    if (fib_cache.valid_bytes == 0)  // no usable header yet: start the file over
+    {
+        fib_cache_header_t header = { FIB_CACHE_MAGIC, FIB_CACHE_VERSION, GMP_NUMB_BITS, 0, 0 };
+        header.sum = fib_cache_sum(0xcbf29ce484222325ull, &header, 2);
+        if (ftruncate(fib_cache.fd, 0) != 0 || pwrite(fib_cache.fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) goto failed;
+        fib_cache.valid_bytes = sizeof(header);
+    }
+
+    fib_cache_record_t rec = { l->k, mpz_size(l->fk), is_pair ? mpz_size(l->fk1) : 0, 0 };
+    const mp_limb_t *fk = mpz_limbs_read(l->fk), *fk1 = mpz_limbs_read(l->fk1);
+    rec.sum = fib_cache_record_sum(&rec, fk, fk1);
+    struct iovec parts[] = {
+        { &rec, sizeof(rec) },
+        { (void *)fk, rec.fk_limbs * sizeof(mp_limb_t) },
+        { (void *)fk1, rec.fk1_limbs * sizeof(mp_limb_t) },
+    };
+    size_t total = sizeof(rec) + (rec.fk_limbs + rec.fk1_limbs) * sizeof(mp_limb_t);
+    if (ftruncate(fib_cache.fd, (off_t)fib_cache.valid_bytes) != 0) goto failed;  // drops a corrupt tail, if any
+    if (pwritev(fib_cache.fd, parts, 3, (off_t)fib_cache.valid_bytes) != (ssize_t)total) goto failed;  // a short write is cut off by the next append, or by the next run's size check
+    fib_cache.valid_bytes += total;
+    fib_cache.entries[fib_cache.n_entries++] = (fib_cache_entry_t){ l->k, NULL, 1 };
+    return;
+
+failed:
+    fprintf(stderr, "Failed to write to the cache file (%s), not caching anymore\n", strerror(errno));
+    close(fib_cache.fd);
+    fib_cache.fd = -1;
+}
+
+// called after every ladder step; stores anchors the cache doesn't have yet
+void fib_cache_note(const fib_ladder_t *l, bool is_pair)
+{
+    if (!fib_cache_is_anchor(l->k)) return;
+    pthread_mutex_lock(&fib_cache.lock);
+    fib_cache_append_locked(l, is_pair);
+    pthread_mutex_unlock(&fib_cache.lock);
+}
+
+// Step tracing (compile with -DFIB_TRACE). Every ladder step (adv, surpass, lean) leaves a record: when it ran and for how
+// long, the cycle counter, the limb counts going in, the multiplication that size gets, and how many bytes GMP allocated
+// meanwhile. Records go into a fixed ring, the newest FIB_TRACE_RING kept, and are written out at exit to the file named by
+// FIBO_TRACE in the environment: CSV if it ends in .csv, Chrome trace JSON (chrome://tracing, Perfetto) otherwise. Without
+// FIBO_TRACE, the CSV goes to stderr. A regular build compiles all of it away.
+// GMP doesn't export its thresholds, so the multiplication is named from typical x86-64 values in its gmp-mparam.h files
+// (override with -DFIB_TRACE_TOOM22=... etc. to match your GMP build's tuning).
+#ifdef FIB_TRACE
+#define FIB_TRACE_ON 1
+#define FIB_TRACE_RING 16384
+#ifndef FIB_TRACE_TOOM22
+#define FIB_TRACE_TOOM22 26
+#endif
+#ifndef FIB_TRACE_TOOM33
+#define FIB_TRACE_TOOM33 73
+#endif
+#ifndef FIB_TRACE_TOOM44
+#define FIB_TRACE_TOOM44 208
+#endif
+#ifndef FIB_TRACE_TOOM6H
+#define FIB_TRACE_TOOM6H 300
+#endif
+#ifndef FIB_TRACE_TOOM8H
+#define FIB_TRACE_TOOM8H 406
+#endif
+#ifndef FIB_TRACE_FFT
+#define FIB_TRACE_FFT 4736
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_CYCLES() __rdtsc()
+#else
+#define TRACE_CYCLES() 0
+#endif
+
+typedef struct {
+    const char *step;
+    uint64_t k;                 // index the step reached
+    uint64_t start_ns, duration_ns, cycles;
+    size_t limbs_k, limbs_k1;   // F(k) and F(k+1) going in
+    const char *mul;            // what their product runs on
+    uint64_t bytes_allocated;   // by GMP during the step, all threads
+    int thread;
+} trace_record_t;
+
+typedef struct {
+    uint64_t start_ns, cycles, bytes_allocated;
+    size_t limbs_k, limbs_k1;
+} trace_mark_t;
+
+static trace_record_t trace_ring[FIB_TRACE_RING];
+static uint64_t trace_count = 0;    // records ever taken; the ring holds the last FIB_TRACE_RING
+static uint64_t trace_epoch_ns = 0;
+static int trace_thread_count = 0;
+static __thread int trace_thread = -1;
+
+static uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec - trace_epoch_ns;
+}
+
+static const char *trace_mul_name(size_t limbs)
+{
+    if (fib_mul_backend != &mul_backends[0] && limbs >= NTT_MIN_LIMBS) return fib_mul_backend->name;
+    if (limbs < FIB_TRACE_TOOM22) return "basecase";
+    if (limbs < FIB_TRACE_TOOM33) return "toom22";
+    if (limbs < FIB_TRACE_TOOM44) return "toom33";
+    if (limbs < FIB_TRACE_TOOM6H) return "toom44";
+    if (limbs < FIB_TRACE_TOOM8H) return "toom6h";
+    if (limbs < FIB_TRACE_FFT) return "toom8h";
+    return "fft";
+}
+
+static trace_mark_t trace_begin(mpz_srcptr fk, mpz_srcptr fk1)
+{
+    return (trace_mark_t){ trace_now_ns(), TRACE_CYCLES(), __atomic_load_n(&mem_stats.bytes_allocated, __ATOMIC_RELAXED), mpz_size(fk), mpz_size(fk1) };
+}
+
+static void trace_end(const trace_mark_t *mark, const char *step, uint64_t k)
+{
+    if (trace_thread < 0) trace_thread = __atomic_fetch_add(&trace_thread_count, 1, __ATOMIC_RELAXED);
+    uint64_t end_ns = trace_now_ns(), cycles = TRACE_CYCLES();
+    trace_record_t *r = &trace_ring[__atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED) % FIB_TRACE_RING];
+    *r = (trace_record_t){
+        .step = step, .k = k, .start_ns = mark->start_ns, .duration_ns = end_ns - mark->start_ns, .cycles = cycles - mark->cycles,
+        .limbs_k = mark->limbs_k, .limbs_k1 = mark->limbs_k1, .mul = trace_mul_name(mark->limbs_k < mark->limbs_k1 ? mark->limbs_k : mark->limbs_k1),
+        .bytes_allocated = __atomic_load_n(&mem_stats.bytes_allocated, __ATOMIC_RELAXED) - mark->bytes_allocated, .thread = trace_thread,
+    };
+}
+
+static void trace_dump(void)
+{
+    const char *path = getenv("FIBO_TRACE");
+    FILE *out = path ? fopen(path, "w") : stderr;
+    if (!out) { fprintf(stderr, "Can't write the trace to %s: %s\n", path, strerror(errno)); return; }
+    bool is_csv = !path || (strlen(path) >= 4 && strcmp(path + strlen(path) - 4, ".csv") == 0);
+
+    uint64_t first = trace_count > FIB_TRACE_RING ? trace_count - FIB_TRACE_RING : 0;
+    if (is_csv) fprintf(out, "step,k,start_ns,duration_ns,cycles,limbs_k,limbs_k1,mul,bytes_allocated,thread\n");
+    else fprintf(out, "{\"traceEvents\": [\n");
+    for (uint64_t i = first; i < trace_count; i++)
+    {
+        const trace_record_t *r = &trace_ring[i % FIB_TRACE_RING];
+        if (is_csv)
+            fprintf(out, "%s,%llu,%llu,%llu,%llu,%zu,%zu,%s,%llu,%d\n", r->step, (unsigned long long)r->k, (unsigned long long)r->start_ns,
+                (unsigned long long)r->duration_ns, (unsigned long long)r->cycles, r->limbs_k, r->limbs_k1, r->mul,
+                (unsigned long long)r->bytes_allocated, r->thread);
+        else
+            fprintf(out, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"k\": %llu, "
+                "\"cycles\": %llu, \"limbs_k\": %zu, \"limbs_k1\": %zu, \"mul\": \"%s\", \"bytes_allocated\": %llu}}%s\n",
+                r->step, r->thread, (double)r->start_ns / 1000, (double)r->duration_ns / 1000, (unsigned long long)r->k,
+                (unsigned long long)r->cycles, r->limbs_k, r->limbs_k1, r->mul, (unsigned long long)r->bytes_allocated,
+                i + 1 < trace_count ? "," : "");
+    }
+    if (!is_csv) fprintf(out, "], \"displayTimeUnit\": \"ns\"}\n");
+    if (out != stderr) fclose(out);
+}
+
+// bytes_allocated needs the counting hooks, so a tracing build always has them on
+static void trace_start(void)
+{
+    trace_epoch_ns = trace_now_ns();
+    atexit(trace_dump);
+}
+
+#define FIB_TRACE_BEGIN(fk, fk1) trace_mark_t trace_mark = trace_begin((fk), (fk1))
+#define FIB_TRACE_END(step, k) trace_end(&trace_mark, (step), (k))
+#else
+#define FIB_TRACE_ON 0
+#define FIB_TRACE_BEGIN(fk, fk1)
+#define FIB_TRACE_END(step, k)
+static void trace_start(void) { }
+#endif
+
+
+#ifdef TESTING  // only for development, don't compile with -DTESTING on the regular
+// after a doubling step from prev_k: the new pair against the table, and the products the step kept against the old pair's
+static void fib_ladder_check(const fib_ladder_t *l, uint64_t prev_k)
+{
+    printf("Did %s iteration. ", (l->k & 1) ? "uneven" : "even");
+    if (l->k + 1 > FIB_SMALL_MAX)
+    {
+        gmp_printf("Can't check efficiently. Exceeded cached Fibonacci values. Current values: %Zd,%Zd\n", l->fk, l->fk1);
+        return;
+    }
+    gmp_printf("Values: F(%llu),F(%llu) = %Zd,%Zd\n", (unsigned long long)l->k, (unsigned long long)l->k + 1, l->fk, l->fk1);
+
+    unsigned __int128 f = fib_small(prev_k), f1 = fib_small(prev_k + 1);  // prev_k <= 92, so their products fit
+    struct { const char *name; mpz_srcptr calculated; unsigned __int128 supposed; } checks[] = {
+        { "F(k)^2",      l->ffk,  f * f },
+        { "F(k+1)F(k)",  l->fk1k, f1 * f },
+        { "F(k+1)^2",    l->ffk1, f1 * f1 },
+        { "Next F(k)",   l->fk,   fib_small(l->k) },
+        { "Next F(k+1)", l->fk1,  fib_small(l->k + 1) },
+    };
+    bool is_fine = true;
+    mpz_t supposed;
+    mpz_init(supposed);
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        mpz_set_ui(supposed, (unsigned long)(checks[i].supposed >> 64));
+        mpz_mul_2exp(supposed, supposed, 64);
+        mpz_add_ui(supposed, supposed, (unsigned long)checks[i].supposed);
+        if (mpz_cmp(supposed, checks[i].calculated) == 0) continue;
+        gmp_printf("At k=%llu, incorrect calculation of %s. Supposed to be %Zd, got %Zd.\n", (unsigned long long)prev_k, checks[i].name, supposed, checks[i].calculated);
+        is_fine = false;
+    }
+    mpz_clear(supposed);
+    if (!is_fine) exit(1);
+}
+#endif
+
+
+// (F(k), F(k+1)) -> (F(2k+bit), F(2k+bit+1))
+// Then find F(k) = F(2x) = F(x) * (2*F(x+1) - F(x))  and  F(k+1) = F(2x+1) = F(x+1)^2 + F(x)^2
+void fib_ladder_double(fib_ladder_t *l, bool is_bit_set)
+{
+    FIB_TRACE_BEGIN(l->fk, l->fk1);
+    bool is_k_even = !(l->k & 1);
+
+    //  F(2k+1)
+    // We also need F(k+1)^2 but instead of wasting time on squaring it directly, I found a way that'd let us cache a different value for later:  F(k+1)^2 = F(k+1)*F(k) + F(k)^2 + (-1)^k
+    mul_job_t products[] = {
+        { l->ffk, l->fk, l->fk },       // F(k)^2
+        { l->fk1k, l->fk1, l->fk },     // F(k+1)F(k)
+    };
+    fib_mul_batch(products, 2);
+    mpz_add(l->ffk1, l->fk1k, l->ffk);  // F(k+1)F(k) + F(k)^2
+    if(is_k_even) mpz_add_ui(l->ffk1, l->ffk1, 1); else mpz_sub_ui(l->ffk1, l->ffk1, 1);  // F(k+1)^2 = F(k+1)*F(k) + F(k)^2 + (-1)^k
+    mpz_add(l->f2k1, l->ffk1, l->ffk);  // F(2k+1) = F(k+1)^2 + F(k)^2
+    mpz_add(l->twofk1k, l->fk1k, l->fk1k);  // 2*F(k+1)F(k)
+
+    // at this point, it'd be good to make no mure multiplications.
+    // Available values are: F(k), F(k+1), F(k)^2 , F(k+1)F(k) , F(2k+1)
+
+    // use all gathered data to jump to x2 index
+    if (is_bit_set)  // uneven, progress fibo by extra 1. All according to the bits of n.
+    {
+        //  F(k+1) <- F(2k+2)
+        // F(2k+2) = F(2k+1) + 2*F(k+1)F(k) - F(k)^2   // I don't remember how I got this formula. "It just works" -Todd Howard
+        // F(2k+2) = F(k+1)^2 + 2*F(k+1)F(k)  // shorter
+        // Could also run longer through Cassini's:  F(2k+2) = F(k+2)^2 - F(k)^2
+        mpz_add(l->fk1, l->ffk1, l->twofk1k);    // F(2k+2) = F(k+1)^2 + 2*F(k+1)F(k)
+
+        //  F(k) <- F(2k+1)
+        mpz_swap(l->fk, l->f2k1);
+    }
+    else  // even. get 2k and 2k+1, no incrementation
+    {
+        //  F(k) <- F(2k)
+        // F(2k) = F(k+1)^2 + F(k+1)*F(k) - 2*F(k)^2 - (-1)^k  // a mix of various; Catalan's, Cassini's, and some of mine.
+        // Could also run longer through Cassini's:  F(2k) = F(k+1)^2 - F(k-1)^2
+        // or back to F(2k) = 2*F(k+1)F(k) - F(k)^2
+        mpz_sub(l->fk, l->twofk1k, l->ffk);    // F(2k) = 2*F(k+1)F(k) - F(k)^2
+
+        //  F(k+1) <- F(2k+1)
+        mpz_swap(l->fk1, l->f2k1);
+    }
+    l->k = 2*l->k + is_bit_set;    fib_cache_note(l, true);
+    FIB_TRACE_END("double", l->k);
+}
+
+// (F(k), F(k+1)) -> F(2k+bit) only. Last step of a ladder, when nobody needs the following value.
+void fib_ladder_double_last(fib_ladder_t *l, bool is_bit_set)
+{
+    FIB_TRACE_BEGIN(l->fk, l->fk1);
+    if (is_bit_set)  // F(2k+1) = F(k+1)^2 + F(k)^2
+    {
+        mul_job_t squares[] = { { l->ffk, l->fk, l->fk }, { l->ffk1, l->fk1, l->fk1 } };
+        fib_mul_batch(squares, 2);
+        mpz_add(l->fk, l->ffk1, l->ffk);
+    }
+    else  // F(2k) = F(k) * (2*F(k+1) - F(k))
+    {
+        mpz_add(l->twofk1k, l->fk1, l->fk1);
+        mpz_sub(l->twofk1k, l->twofk1k, l->fk);
+        fib_mul(l->ffk, l->fk, l->twofk1k);
+        mpz_swap(l->fk, l->ffk);
+    }
+    l->k = 2*l->k + is_bit_set;    fib_cache_note(l, false);
+    FIB_TRACE_END("double_last", l->k);
+}
+
+// (F(k), F(k+1)) -> (F(3k+r), F(3k+r+1)), r in {0,1,2}
+// F(3k) = 5*F(k)^3 + (-1)^k*3*F(k)  and  F(3k+1) = F(k+1)^3 + 3*F(k+1)F(k)^2 - F(k)^3 = F(k+1)*(F(k+1)^2 + 3*F(k)^2) - F(k)^3
+void fib_ladder_triple(fib_ladder_t *l, unsigned r)
+{
+    FIB_TRACE_BEGIN(l->fk, l->fk1);
+    bool is_k_even = !(l->k & 1);
+
+    mul_job_t squares[] = {
+        { l->ffk, l->fk, l->fk },         // F(k)^2
+        { l->ffk1, l->fk1, l->fk1 },      // F(k+1)^2
+    };
+    fib_mul_batch(squares, 2);
+    mpz_mul_ui(l->twofk1k, l->ffk, 3);    // 3*F(k)^2
+    mpz_add(l->twofk1k, l->twofk1k, l->ffk1);  // F(k+1)^2 + 3*F(k)^2
+    mul_job_t cubes[] = {
+        { l->fk1k, l->ffk, l->fk },       // F(k)^3
+        { l->f2k1, l->fk1, l->twofk1k },  // F(k+1)*(F(k+1)^2 + 3*F(k)^2)
+    };
+    fib_mul_batch(cubes, 2);
+    mpz_sub(l->f2k1, l->f2k1, l->fk1k);        // F(3k+1)
+
+    mpz_mul_ui(l->ffk, l->fk, 3);         // 3*F(k)
+    mpz_mul_ui(l->fk, l->fk1k, 5);        // 5*F(k)^3
+    if (is_k_even) mpz_add(l->fk, l->fk, l->ffk); else mpz_sub(l->fk, l->fk, l->ffk);  // F(3k)
+
+    // now F(k) holds F(3k) and f2k1 holds F(3k+1), walk up by r
+    switch (r)
+    {
+        case 0:
+            mpz_swap(l->fk1, l->f2k1);              // (F(3k), F(3k+1))
+            break;
+        case 1:
+            mpz_add(l->fk1, l->fk, l->f2k1);        // F(3k+2)
+            mpz_swap(l->fk, l->f2k1);               // (F(3k+1), F(3k+2))
+            break;
+        default:
+            mpz_add(l->ffk, l->fk, l->f2k1);        // F(3k+2)
+            mpz_add(l->fk1, l->f2k1, l->ffk);       // F(3k+3)
+            mpz_swap(l->fk, l->ffk);                // (F(3k+2), F(3k+3))
+            break;
+    }
+    l->k = 3*l->k + r;    fib_cache_note(l, true);
+    FIB_TRACE_END("triple", l->k);
+}
+
+// F(k) -> F(3k) without F(k+1) at all. F(3k) = 5*F(k)^3 + (-1)^k*3*F(k). F(k+1) is left stale.
+void fib_ladder_triple_last(fib_ladder_t *l)
+{
+    FIB_TRACE_BEGIN(l->fk, l->fk1);
+    bool is_k_even = !(l->k & 1);
+
+    fib_mul(l->ffk, l->fk, l->fk);        // F(k)^2
+    fib_mul(l->fk1k, l->ffk, l->fk);      // F(k)^3
+    mpz_mul_ui(l->fk1k, l->fk1k, 5);      // 5*F(k)^3
+    mpz_mul_ui(l->ffk, l->fk, 3);         // 3*F(k)
+    if (is_k_even) mpz_add(l->fk, l->fk1k, l->ffk); else mpz_sub(l->fk, l->fk1k, l->ffk);
+    l->k *= 3;    fib_cache_note(l, false);
+    FIB_TRACE_END("triple_last", l->k);
+}
+
+
+// Planning the surpass ladder. n is written in a mixed base-2/base-3 form, n = ((d1*q2 + d2)*q3 + d3)... where each q is 2 or 3,
+// and the ladder walks it from the top. Every state the ladder can visit is floor(n / (2^a * 3^b)), so (a,b) is a complete memo key.
+// Costs are estimated by the size of the products each step makes (the additions are noise next to them).
+#define SURPASS_MAX_HALVINGS 64   // n / 2^64 is 0 for any uint64_t
+#define SURPASS_MAX_THIRDINGS 41  // 3^41 > 2^64
+
+typedef struct {
+    double pair_cost[SURPASS_MAX_HALVINGS][SURPASS_MAX_THIRDINGS];    // cost of reaching (F(k), F(k+1)), negative means unknown yet
+    double single_cost[SURPASS_MAX_HALVINGS][SURPASS_MAX_THIRDINGS];  // cost of reaching F(k) alone
+    char pair_step[SURPASS_MAX_HALVINGS][SURPASS_MAX_THIRDINGS];      // '2' double, '3' triple, 'C' from the cache
+    char single_step[SURPASS_MAX_HALVINGS][SURPASS_MAX_THIRDINGS];    // 'D' last doubling, 'T' pair tripling, 'S' single tripling, 'C' from the cache
+} surpass_plan_t;
+
+static double mul_cost(double x_bits, double y_bits) { double s = x_bits + y_bits; return s * (64 - __builtin_clzll((uint64_t)s | 1)); }  // ~ s*log(s), FFT-ish
+static double sqr_cost(double x_bits) { return mul_cost(x_bits, x_bits) * 2 / 3; }  // squaring saves about a third
+
+static double cost_double(uint64_t k) { double b = fib_bits(k); return sqr_cost(b) + mul_cost(b, b); }
+static double cost_double_last(uint64_t k, bool is_odd) { double b = fib_bits(k); return is_odd ? 2*sqr_cost(b) : mul_cost(b, b); }
+static double cost_triple(uint64_t k) { double b = fib_bits(k); return 2*sqr_cost(b) + 2*mul_cost(2*b, b); }
+static double cost_triple_last(uint64_t k) { double b = fib_bits(k); return sqr_cost(b) + mul_cost(2*b, b); }
+
+double surpass_plan_pair(surpass_plan_t *p, int a, int b, uint64_t k)
+{
+    if (k == 0) return 0;  // (F(0), F(1)) is where every ladder starts
+    if (p->pair_cost[a][b] >= 0) return p->pair_cost[a][b];
+    if (fib_cache_find(k, true)) return p->pair_step[a][b] = 'C', p->pair_cost[a][b] = 0;
+
+    double by_double = surpass_plan_pair(p, a+1, b, k/2) + cost_double(k/2);
+    double by_triple = surpass_plan_pair(p, a, b+1, k/3) + cost_triple(k/3);
+    p->pair_step[a][b] = by_triple < by_double ? '3' : '2';
+    return p->pair_cost[a][b] = by_triple < by_double ? by_triple : by_double;
+}
+
+double surpass_plan_single(surpass_plan_t *p, int a, int b, uint64_t k)
+{
+    if (p->single_cost[a][b] >= 0) return p->single_cost[a][b];
+    if (fib_cache_find(k, false)) return p->single_step[a][b] = 'C', p->single_cost[a][b] = 0;
+
+    double best = surpass_plan_pair(p, a+1, b, k/2) + cost_double_last(k/2, k & 1);
+    char step = 'D';
+    double by_triple = surpass_plan_pair(p, a, b+1, k/3) + cost_triple(k/3);
+    if (by_triple < best) { best = by_triple; step = 'T'; }
+    if (k % 3 == 0)  // only F(k/3) is needed to get F(k)
+    {
+        double by_single = surpass_plan_single(p, a, b+1, k/3) + cost_triple_last(k/3);
+        if (by_single < best) { best = by_single; step = 'S'; }
+    }
+    p->single_step[a][b] = step;
+    return p->single_cost[a][b] = best;
+}
+
+void surpass_walk_pair(surpass_plan_t *p, fib_ladder_t *l, int a, int b, uint64_t k)
+{
+    if (k == 0) return;
+    if (p->pair_step[a][b] == 'C') fib_cache_load(l, fib_cache_find(k, true));
+    else if (p->pair_step[a][b] == '3') { surpass_walk_pair(p, l, a, b+1, k/3); fib_ladder_triple(l, k % 3); }
+    else { surpass_walk_pair(p, l, a+1, b, k/2); fib_ladder_double(l, k & 1); }
+}
+
+void surpass_walk_single(surpass_plan_t *p, fib_ladder_t *l, int a, int b, uint64_t k)
+{
+    switch (p->single_step[a][b])
+    {
+        case 'C': fib_cache_load(l, fib_cache_find(k, false)); break;
+        case 'S': surpass_walk_single(p, l, a, b+1, k/3); fib_ladder_triple_last(l); break;
+        case 'T': surpass_walk_pair(p, l, a, b+1, k/3); fib_ladder_triple(l, k % 3); break;
+        default:  surpass_walk_pair(p, l, a+1, b, k/2); fib_ladder_double_last(l, k & 1); break;
+    }
+}
+
+// Mixed-radix ladder: climbs n by doubling and tripling steps, choosing per n the walk with the cheapest multiplications.
+// Powers of 3 (and anything with trailing factors of 3) get the tripling identity on F(k) alone, which needs no F(k+1) at all:
+// Calculate this over and over: F(3k) = 5*F(k)^3 + (-1)^k*3*F(k).
+// Leaves F(n) in l->fk. The ladder is restarted from F(0) whatever it held.
+void fib_surpass_walk(fib_ladder_t *l, surpass_plan_t *plan, uint64_t n)
+{
+    for (int a = 0; a < SURPASS_MAX_HALVINGS; a++)
+        for (int b = 0; b < SURPASS_MAX_THIRDINGS; b++)
+            plan->pair_cost[a][b] = plan->single_cost[a][b] = -1;
+
+    mpz_set_ui(l->fk, 0);
+    mpz_set_ui(l->fk1, 1);
+    l->k = 0;
+    surpass_plan_single(plan, 0, 0, n);
+    surpass_walk_single(plan, l, 0, 0, n);
+}
+
 void fib_surpass(uint64_t n, bool is_printing)
 {
-    mpz_t fk, fffk;
-    mpz_init_set_ui(fk, 1);    // F(k)
-    mpz_init_set_ui(fffk, 1);  // F(k)^3
+    static surpass_plan_t plan;  // ~40KB, keep it off the stack
+    fib_ladder_t l;
+    fib_ladder_init(&l, n);
+
+    fib_surpass_walk(&l, &plan, n);
+
+    // printing
+    if (is_printing) fib_print(l.fk);
+
+    // // cleanup
+    fib_ladder_clear(&l);
+}
+
+// find by finding fibo(k/2) (and find that through fibo(k/4)...)
+// Then find F(k) = F(2x) = F(x) * (2*F(x+1) - F(x))  and  F(k+1) = F(2x+1) = F(x+1)^2 + F(x)^2
+// Basically we're multiplying by 2 and adding 1 according to the binary representation of the sought index
+void fib_adv(uint64_t n, bool is_printing)
+{
+    fib_ladder_t l;
+    fib_ladder_init(&l, n);  // F(k) at index 0, but we start from index 1, so we'll never get back 0
+
+    // create a number that we can iterate on its bits in reverse order
+    uint64_t inverted_n = 0;
+    int bits_in_n = 0;  // count how many bits n has
+    for (uint64_t n_copy = n ; n_copy > 0 ; n_copy >>= 1)
+    {
+        inverted_n <<= 1;
+        if (n_copy & 1) inverted_n++;  // for every 1 we take out of n, we put one in its inversion (from the other direction)
+        bits_in_n++;
+    }
+
+    // with --cache, jump to the longest prefix of n (a state this ladder passes anyway) that has its pair stored
+    int first_bit = 0;
+    for (int shift = 0; shift < bits_in_n; shift++)
+    {
+        const fib_cache_record_t *rec = fib_cache_find(n >> shift, true);
+        if (!rec) continue;
+        fib_cache_load(&l, rec);
+        first_bit = bits_in_n - shift;
+        inverted_n = first_bit < 64 ? inverted_n >> first_bit : 0;
+        break;
+    }
+    
+    // for each bit of inverted n (or: for each bit in n, from MSB to LSB), until (including) our location matches the original goal
+    for (int bitnum = first_bit ; bitnum < bits_in_n ; bitnum++, inverted_n >>= 1)
+    {
+        #ifdef TESTING
+            uint64_t prev_k = l.k;
+        #endif
+        fib_ladder_double(&l, inverted_n & 1);
+        #ifdef TESTING
+            fib_ladder_check(&l, prev_k);
+        #endif
+    }
     
-    // Calculate this over and over: F(3k) = 5*F(k)^3 + (-1)^k*3*F(k). We only use odd index, so: F(3k) = 5*F(k)^3 - 3*F(k)
-    for (uint64_t i = 1; i < n; i*=3)
+    // printing
+    if (is_printing) fib_print(l.fk);  // print trailing item
+    
+    // // cleanup
+    fib_ladder_clear(&l);
+}
+
+
+// adv's ladder with the smallest live set a doubling step allows: F(k), F(k+1), P = F(k+1)F(k) and Q = F(k)^2.
+// F(2k) = 2P - Q  and  F(2k+1) = P + 2Q + (-1)^k  (F(k+1)^2 = P + Q + (-1)^k, see fib_ladder_double), F(2k+2) = F(2k) + F(2k+1).
+// Once P and Q exist F(k) and F(k+1) are dead, so the new pair goes straight into their buffers: 4 values of up to F(2k)'s
+// size instead of adv's 7. --mem-limit runs default to it.
+// --progress prints a line per step with an ETA. Each step multiplies numbers twice as long as the last one did, at close
+// to linear cost, so the remaining steps are estimated at twice the previous one each.
+static double lean_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void fib_lean(uint64_t n, bool is_printing)
+{
+    mpz_t fk, fk1, p, q;
+    fib_init_for(fk, n);    mpz_set_ui(fk, 0);   // F(0)
+    fib_init_for(fk1, n);   mpz_set_ui(fk1, 1);  // F(1)
+    fib_init_for(p, n);
+    fib_init_for(q, n);
+
+    int bits_in_n = n ? 64 - __builtin_clzll(n) : 0;
+    double start = lean_now(), step_start = start;
+    for (int bit = bits_in_n - 1; bit >= 0; bit--)
+    {
+        FIB_TRACE_BEGIN(fk, fk1);
+        bool is_bit_set = (n >> bit) & 1;
+        bool is_k_even = !((n >> (bit + 1)) & 1);  // k is n's bits above this one
+        if (bit == 0 && !is_bit_set)  // last and even: F(2k) = F(k) * (2F(k+1) - F(k)), one product
+        {
+            mpz_mul_2exp(fk1, fk1, 1);
+            mpz_sub(fk1, fk1, fk);
+            fib_mul(q, fk, fk1);
+            mpz_swap(fk, q);
+        }
+        else
+        {
+            mul_job_t products[] = { { q, fk, fk }, { p, fk1, fk } };
+            fib_mul_batch(products, 2);
+            mpz_ptr f2k1 = is_bit_set ? fk : fk1;  // F(2k+1) is the new F(k) or the new F(k+1)
+            mpz_mul_2exp(f2k1, q, 1);
+            mpz_add(f2k1, f2k1, p);
+            if (is_k_even) mpz_add_ui(f2k1, f2k1, 1); else mpz_sub_ui(f2k1, f2k1, 1);
+            if (!is_bit_set || bit > 0)  // F(2k), or F(2k+2) = F(2k) + F(2k+1) unless this is the last step
+            {
+                mpz_ptr other = is_bit_set ? fk1 : fk;
+                mpz_mul_2exp(other, p, 1);
+                mpz_sub(other, other, q);
+                if (is_bit_set) mpz_add(other, other, fk);
+            }
+        }
+        FIB_TRACE_END("lean", n >> bit);
+
+        if (fib_opts.is_progress)
+        {
+            double now = lean_now(), step_time = now - step_start;
+            step_start = now;
+            fprintf(stderr, "step %d/%d: F(%llu), %.1f MiB, %.2fs elapsed, about %.2fs to go\n", bits_in_n - bit, bits_in_n,
+                (unsigned long long)(n >> bit), (double)mpz_size(fk) * sizeof(mp_limb_t) / (1 << 20), now - start,
+                step_time * (double)((2ull << bit) - 2));
+        }
+    }
+
+    if (is_printing) fib_print(fk);
+    mpz_clears(fk, fk1, p, q, NULL);
+}
+
+
+
+// Lucas doubling: carries F(k) with the Lucas number L(k) (2, 1, 3, 4, 7, 11...) instead of F(k+1). Per bit:
+// F(2k) = F(k)L(k),  L(2k) = L(k)^2 - 2*(-1)^k,  and for a set bit  F(2k+1) = (F(2k)+L(2k))/2,  L(2k+1) = (5*F(2k)+L(2k))/2.
+// That's a product and a square per bit, like adv, but the last bit takes a single product:
+// F(2k) = F(k)L(k)  or  F(2k+1) = F(k+1)L(k) - (-1)^k  with F(k+1) = (F(k)+L(k))/2.
+void fib_lucas_into(mpz_ptr result, uint64_t n)
+{
+    if (n == 0) { mpz_set_ui(result, 0); return; }
+    mpz_t f, l, fl, ll;
+    fib_init_for(f, n);   mpz_set_ui(f, 0);  // F(0)
+    fib_init_for(l, n);   mpz_set_ui(l, 2);  // L(0)
+    fib_init_for(fl, n);
+    fib_init_for(ll, n);
+    uint64_t k = 0;
+
+    for (int bit = 63 - __builtin_clzll(n); bit > 0; bit--)
+    {
+        bool is_bit_set = (n >> bit) & 1;
+        mul_job_t products[] = { { fl, f, l }, { ll, l, l } };
+        fib_mul_batch(products, 2);
+        if (k & 1) mpz_add_ui(ll, ll, 2); else mpz_sub_ui(ll, ll, 2);  // L(2k)
+        if (is_bit_set)
+        {
+            mpz_add(f, fl, ll);
+            mpz_tdiv_q_2exp(f, f, 1);   // F(2k+1)
+            mpz_mul_ui(l, fl, 5);
+            mpz_add(l, l, ll);
+            mpz_tdiv_q_2exp(l, l, 1);   // L(2k+1)
+        }
+        else
+        {
+            mpz_swap(f, fl);
+            mpz_swap(l, ll);
+        }
+        k = 2*k + is_bit_set;
+    }
+
+    if (n & 1)
+    {
+        mpz_add(fl, f, l);
+        mpz_tdiv_q_2exp(fl, fl, 1);     // F(k+1)
+        fib_mul(result, fl, l);
+        if (k & 1) mpz_add_ui(result, result, 1); else mpz_sub_ui(result, result, 1);
+    }
+    else fib_mul(result, f, l);
+
+    mpz_clears(f, l, fl, ll, NULL);
+}
+
+void fib_lucas(uint64_t n, bool is_printing)
+{
+    mpz_t result;
+    fib_init_for(result, n);
+    fib_lucas_into(result, n);
+    if (is_printing) fib_print(result);
+    mpz_clear(result);
+}
+
+// Matrix power: [[1,1],[1,0]]^k = [[F(k+1), F(k)], [F(k), F(k-1)]], by squaring and multiplying from the top bit down.
+// The powers are symmetric, so squaring [[a,b],[b,c]] only needs a^2+b^2, b(a+c) and b^2+c^2, and since c = a-b the last one is
+// the difference of the other two. 2 squares and a product per bit; a set bit multiplies by [[1,1],[1,0]]: (a, b) -> (a+b, a).
+void fib_matrix_into(mpz_ptr result, uint64_t n)
+{
+    if (n == 0) { mpz_set_ui(result, 0); return; }
+    mpz_t a, b, aa, bb, bsum, sum;
+    fib_init_for(a, n);   mpz_set_ui(a, 1);  // identity: F(1), F(0)
+    fib_init_for(b, n);   mpz_set_ui(b, 0);
+    fib_init_for(aa, n);
+    fib_init_for(bb, n);
+    fib_init_for(bsum, n);
+    fib_init_for(sum, n);
+
+    for (int bit = 63 - __builtin_clzll(n); bit >= 0; bit--)
+    {
+        mpz_add(sum, a, a);
+        mpz_sub(sum, sum, b);           // a + c
+        mul_job_t products[] = { { aa, a, a }, { bb, b, b }, { bsum, b, sum } };
+        fib_mul_batch(products, 3);
+        mpz_swap(b, bsum);              // b = b(a+c)
+        mpz_add(a, aa, bb);             // a = a^2 + b^2
+        if ((n >> bit) & 1)
+        {
+            mpz_add(sum, a, b);
+            mpz_swap(b, a);
+            mpz_swap(a, sum);
+        }
+    }
+    mpz_swap(result, b);
+
+    mpz_clears(a, b, aa, bb, bsum, sum, NULL);
+}
+
+void fib_matrix(uint64_t n, bool is_printing)
+{
+    mpz_t result;
+    fib_init_for(result, n);
+    fib_matrix_into(result, n);
+    if (is_printing) fib_print(result);
+    mpz_clear(result);
+}
+
+
+void fib_straight(uint64_t index, bool is_printing)
+{
+    mpz_t trailing, leading;
+    fib_init_for(trailing, index);  mpz_set_ui(trailing, 1);
+    fib_init_for(leading, index);   mpz_set_ui(leading, 1);
+
+    // calculation
+    for (uint64_t i = 3; i <= index; ++i)  // we want to include index, so we use <=
+    {
+        mpz_swap(trailing, leading);          // f(k) = f(k+1)
+        mpz_add(leading, trailing, leading);  // f(k+1) = f(k+1) + f(k)
+    }
+
+    // printing
+    if (is_printing) fib_print(leading);
+
+    // cleanup
+    mpz_clear(trailing);
+    mpz_clear(leading);
+}
+
+
+// mostly copied (not that it's complicated, but the typing is a good idea) from:  https://github.com/SheafificationOfG/Fibsonisheaf/blob/main/impl/naive.c
+void fib_naive(uint64_t index, uint64_t *result)  // uint64_t can store up to Fib[93]=12200160415121876738 . We won't reach 93 in naive solution, so we can keep it simple and efficient
+{
+    if (index <= 2)
+    {
+        *result = 1;
+        return;
+    }
+
+    uint64_t a, b;
+    fib_naive(index-1, &a);
+    fib_naive(index-2, &b);
+    *result = a + b;
+}
+
+void fib_naive_caller(uint64_t index, bool is_printing)  // the naive method is recursive, so we need an external one
+{
+    uint64_t result;
+    fib_naive(index, &result);
+
+    if (is_printing)
+    {
+        mpz_t big_result;
+        mpz_init_set_ui(big_result, result);  // unsigned long is 64 bits here (see the -m64 in compare_runtime.sh)
+        fib_print(big_result);
+        mpz_clear(big_result);
+    }
+}
+
+
+// Every --algo choice. auto isn't one of them: it's resolved to one of these per index, see fib_auto_pick().
+typedef struct {
+    const char *name;
+    void (*run)(uint64_t n, bool is_printing);
+    bool is_auto_candidate;  // naive is exponential, never worth measuring
+} fib_algo_t;
+
+static const fib_algo_t fib_algos[] = {
+    { "naive",    fib_naive_caller, false },
+    { "straight", fib_straight,     true },
+    { "adv",      fib_adv,          true },
+    { "surpass",  fib_surpass,      true },
+    { "lucas",    fib_lucas,        true },
+    { "matrix",   fib_matrix,       true },
+    { "lean",     fib_lean,         false },  // adv with a smaller footprint, not a speedup
+};
+enum { ALGO_NAIVE, ALGO_STRAIGHT, ALGO_ADV, ALGO_SURPASS, ALGO_LUCAS, ALGO_MATRIX, ALGO_LEAN, ALGO_COUNT };
+
+static int fib_algo_from_name(const char *name)
+{
+    for (int i = 0; i < ALGO_COUNT; i++) if (strcmp(name, fib_algos[i].name) == 0) return i;
+    return -1;
+}
+
+
+// --algo auto. Picks by index from a table of (from index, algorithm) rows: the last row whose index is <= n wins.
+// --calibrate measures the table on this machine (with whatever --threads/--mul it's given) and writes it to the config file;
+// without one, the table below is used, measured the same way on a single-core x86-64 with GMP 6.3.
+#define AUTO_MAX_ROWS 64
+#define AUTO_CALIBRATE_MAX_BITS 23   // the sweep stops at 2^23; the last row covers everything above
+#define AUTO_CALIBRATE_MIN_NS 20000000.0  // repeat each measurement until it takes at least this long
+
+typedef struct {
+    uint64_t from_n;
+    int algo;
+} auto_row_t;
+
+static auto_row_t auto_rows[AUTO_MAX_ROWS] = {
+    { 1, ALGO_STRAIGHT },
+    { 48, ALGO_LUCAS },
+};
+static int auto_n_rows = 2;
+
+static const char *fib_config_path(void)
+{
+    if (fib_opts.config_path) return fib_opts.config_path;
+    static char path[4096];
+    const char *home = getenv("HOME");
+    if (!home || snprintf(path, sizeof(path), "%s/.config/fibo_c.conf", home) >= (int)sizeof(path)) return NULL;
+    return path;
+}
+
+// reads the table from the config file if there is one; a missing file is fine, a broken one is reported and skipped
+void fib_auto_load(void)
+{
+    const char *path = fib_config_path();
+    FILE *f = path ? fopen(path, "r") : NULL;
+    if (!f)
+    {
+        if (fib_opts.config_path) fprintf(stderr, "Can't read the config file %s (%s), using the built-in thresholds\n", path, strerror(errno));
+        return;
+    }
+
+    auto_row_t rows[AUTO_MAX_ROWS];
+    int n_rows = 0;
+    char line[256], name[32];
+    unsigned long long from_n;
+    bool is_valid = true;
+    while (is_valid && fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        int algo = -1;
+        if (sscanf(line, "%llu %31s", &from_n, name) == 2) algo = fib_algo_from_name(name);
+        is_valid = algo >= 0 && fib_algos[algo].is_auto_candidate && n_rows < AUTO_MAX_ROWS && (n_rows ? from_n > rows[n_rows-1].from_n : from_n == 1);
+        if (is_valid) rows[n_rows++] = (auto_row_t){ from_n, algo };
+    }
+    fclose(f);
+
+    if (!is_valid || n_rows == 0) { fprintf(stderr, "The config file %s is malformed, using the built-in thresholds\n", path); return; }
+    memcpy(auto_rows, rows, sizeof(rows[0]) * n_rows);
+    auto_n_rows = n_rows;
+}
+
+const char *fib_auto_pick(uint64_t n)
+{
+    int row = 0;
+    while (row + 1 < auto_n_rows && auto_rows[row + 1].from_n <= n) row++;
+    return fib_algos[auto_rows[row].algo].name;
+}
+
+static double fib_time_ns(int algo, uint64_t n)
+{
+    double best = -1;
+    for (int attempt = 0; attempt < 3; attempt++)  // best of 3, each averaged over enough repeats to dwarf the clock
+    {
+        struct timespec start, end;
+        int reps = 0;
+        double elapsed;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do
+        {
+            fib_algos[algo].run(n, false);
+            reps++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        } while (elapsed < AUTO_CALIBRATE_MIN_NS);
+        if (best < 0 || elapsed / reps < best) best = elapsed / reps;
+    }
+    return best;
+}
+
+// --calibrate: times every candidate at n = 2^1, 2^1.5, 2^2 ... 2^23, and writes which one was fastest where
+int fib_calibrate(void)
+{
+    bool is_dropped[ALGO_COUNT] = { false };
+    auto_row_t rows[AUTO_MAX_ROWS];
+    int n_rows = 0;
+    int challenger = -1;  // a new winner needs two sweep points in a row to start a row, so noise doesn't flip-flop the table
+    uint64_t challenger_n = 0;
+
+    printf("%12s", "n");
+    for (int algo = 0; algo < ALGO_COUNT; algo++) if (fib_algos[algo].is_auto_candidate) printf(" %10s", fib_algos[algo].name);
+    printf("   (microseconds)\n");
+
+    for (int half_bits = 2; half_bits <= 2 * AUTO_CALIBRATE_MAX_BITS; half_bits++)
+    {
+        uint64_t n = half_bits & 1 ? ((1ull << (half_bits / 2)) * 181 + 64) / 128 : 1ull << (half_bits / 2);  // 181/128 ~ sqrt(2)
+        double times[ALGO_COUNT], best_time = -1;
+        int best = -1;
+        for (int algo = 0; algo < ALGO_COUNT; algo++)
+        {
+            times[algo] = -1;
+            if (!fib_algos[algo].is_auto_candidate || is_dropped[algo]) continue;
+            times[algo] = fib_time_ns(algo, n);
+            if (best < 0 || times[algo] < best_time) { best = algo; best_time = times[algo]; }
+        }
+        for (int algo = 0; algo < ALGO_COUNT; algo++)  // hopelessly behind (straight's n^2 mostly): stop measuring it
+            if (times[algo] > 20 * best_time && times[algo] > 1e6) is_dropped[algo] = true;
+
+        printf("%12llu", (unsigned long long)n);
+        for (int algo = 0; algo < ALGO_COUNT; algo++)
+            if (fib_algos[algo].is_auto_candidate) { if (times[algo] < 0) printf(" %10s", "-"); else printf(" %10.1f", times[algo] / 1000); }
+        printf("   %s\n", fib_algos[best].name);
+        fflush(stdout);
+
+        if (n_rows == 0) rows[n_rows++] = (auto_row_t){ 1, best };
+        else if (rows[n_rows-1].algo == best) challenger = -1;
+        else if (challenger != best) { challenger = best; challenger_n = n; }
+        else if (n_rows < AUTO_MAX_ROWS) { rows[n_rows++] = (auto_row_t){ challenger_n, best }; challenger = -1; }
+    }
+
+    const char *path = fib_config_path();
+    FILE *f = path ? fopen(path, "w") : NULL;
+    if (!f) return fprintf(stderr, "Can't write the config file %s (%s)\n", path ? path : "(no $HOME)", strerror(errno)), 1;
+    fprintf(f, "# --algo auto thresholds, written by --calibrate\n# <from index> <algorithm>\n");
+    for (int row = 0; row < n_rows; row++) fprintf(f, "%llu %s\n", (unsigned long long)rows[row].from_n, fib_algos[rows[row].algo].name);
+    fclose(f);
+    printf("wrote %s\n", path);
+    return 0;
+}
+
+
+// one index the way main() runs it: small indices take the fast paths, and auto resolves to an engine
+// is_named: the caller asked for this engine (--algo), rather than getting the default
+void fib_run(const char *algo, bool is_named, uint64_t index, bool is_printing)
+{
+    bool is_shortcut_ok = !is_named || strcmp(algo, "auto") == 0;
+    if (is_shortcut_ok && index <= FIB_SMALL_MAX) { if (is_printing) fib_print_u128(fib_small(index)); }
+    else if (is_shortcut_ok && fib_stack_fits(index)) fib_stack(index, is_printing);
+    else fib_algos[fib_algo_from_name(strcmp(algo, "auto") == 0 ? fib_auto_pick(index) : algo)].run(index, is_printing);
+}
+
+
+// Batch mode (--batch): "<index>" or "<index> <algo>" lines on stdin, results on stdout in the same order.
+// The queries are answered sorted by index and every engine keeps its working set between them: straight just counts on,
+// adv keeps the pair at each prefix of its previous index and resumes from the longest prefix the next one shares (or adds
+// its way up when the next index is only a few further), surpass reuses its ladder and plan. Results go out as soon as all
+// the earlier lines are done. With --threads and at least as many queries as threads, each thread takes a run of the sorted
+// queries with its own engine, instead of all of them splitting every multiplication.
+#define BATCH_MAX_WALK 64  // adv: up to this many F(k+1) = F(k) + F(k-1) steps are cheaper than climbing from a prefix
+
+typedef struct {
+    uint64_t n;
+    int algo;
+    bool is_shortcut_ok;  // default engine or auto, so the u128 table may answer (see fib_run)
+    size_t line;  // position among the queries as they were read
+    mpz_t result;
+    bool is_done;
+} batch_query_t;
+
+typedef struct {
+    fib_ladder_t l;
+    mpz_t trail_fk[64], trail_fk1[64];  // adv: (F(k), F(k+1)) at k = trail_k[s], which was n >> s for some earlier n
+    uint64_t trail_k[64];
+    mpz_t trailing, leading;            // straight: F(straight_k - 1), F(straight_k)
+    uint64_t straight_k;
+    surpass_plan_t *plan;
+} batch_engine_t;
+
+typedef struct {
+    batch_query_t *queries;  // sorted
+    size_t *chunk_first;     // chunk i is queries [chunk_first[i], chunk_first[i+1])
+    batch_query_t **by_line;
+    size_t n_queries, next_to_print;
+    bool is_printing, is_streaming;
+} batch_t;
+
+static void batch_engine_init(batch_engine_t *e, uint64_t max_n)
+{
+    fib_ladder_init(&e->l, max_n);
+    for (int s = 0; s < 64; s++)
+    {
+        fib_init_for(e->trail_fk[s], max_n >> s);
+        fib_init_for(e->trail_fk1[s], max_n >> s);
+        e->trail_k[s] = UINT64_MAX;  // nothing there yet
+    }
+    fib_init_for(e->trailing, max_n);  mpz_set_ui(e->trailing, 1);
+    fib_init_for(e->leading, max_n);   mpz_set_ui(e->leading, 1);
+    e->straight_k = 2;
+    e->plan = malloc(sizeof(surpass_plan_t));
+}
+
+static void batch_engine_clear(batch_engine_t *e)
+{
+    fib_ladder_clear(&e->l);
+    for (int s = 0; s < 64; s++) mpz_clears(e->trail_fk[s], e->trail_fk1[s], NULL);
+    mpz_clears(e->trailing, e->leading, NULL);
+    free(e->plan);
+}
+
+static void batch_adv(batch_engine_t *e, uint64_t n, mpz_ptr result)
+{
+    int bits = 64 - __builtin_clzll(n);
+    int shift = bits;  // from (F(0), F(1)) if no prefix is known
+    for (int s = 0; s < bits; s++) if (e->trail_k[s] == n >> s) { shift = s; break; }
+
+    uint64_t k = e->trail_k[0];
+    if (shift > 0 && k != UINT64_MAX && k <= n && n - k <= BATCH_MAX_WALK)
+    {
+        for (; k < n; k++)
+        {
+            mpz_add(e->trail_fk[0], e->trail_fk[0], e->trail_fk1[0]);  // F(k+2) where F(k) was
+            mpz_swap(e->trail_fk[0], e->trail_fk1[0]);
+        }
+        e->trail_k[0] = n;
+    }
+    else if (shift > 0)
+    {
+        fib_ladder_t *l = &e->l;
+        if (shift == bits) { mpz_set_ui(l->fk, 0); mpz_set_ui(l->fk1, 1); l->k = 0; }
+        else { mpz_set(l->fk, e->trail_fk[shift]); mpz_set(l->fk1, e->trail_fk1[shift]); l->k = e->trail_k[shift]; }
+        for (int s = shift - 1; s >= 0; s--)
+        {
+            fib_ladder_double(l, (n >> s) & 1);
+            mpz_set(e->trail_fk[s], l->fk);
+            mpz_set(e->trail_fk1[s], l->fk1);
+            e->trail_k[s] = l->k;
+        }
+    }
+    mpz_set(result, e->trail_fk[0]);
+}
+
+static void batch_straight(batch_engine_t *e, uint64_t n, mpz_ptr result)
+{
+    if (n <= 2) { mpz_set_ui(result, 1); return; }
+    if (n < e->straight_k)  // only sorted runs count on, start over otherwise
+    {
+        mpz_set_ui(e->trailing, 1);
+        mpz_set_ui(e->leading, 1);
+        e->straight_k = 2;
+    }
+    for (; e->straight_k < n; e->straight_k++)
+    {
+        mpz_swap(e->trailing, e->leading);
+        mpz_add(e->leading, e->trailing, e->leading);
+    }
+    mpz_set(result, e->leading);
+}
+
+static void batch_answer(batch_engine_t *e, batch_query_t *q)
+{
+    mpz_init(q->result);
+    if (q->is_shortcut_ok && q->n <= FIB_SMALL_MAX)
+    {
+        unsigned __int128 v = fib_small(q->n);
+        mp_limb_t *limbs = mpz_limbs_write(q->result, 2);
+        limbs[0] = (mp_limb_t)v;
+        limbs[1] = (mp_limb_t)(v >> 64);
+        mpz_limbs_finish(q->result, limbs[1] ? 2 : 1);
+    }
+    else switch (q->algo)
+    {
+        case ALGO_NAIVE:
+        {
+            uint64_t result;
+            fib_naive(q->n, &result);
+            mpz_set_ui(q->result, result);
+            break;
+        }
+        case ALGO_STRAIGHT: batch_straight(e, q->n, q->result); break;
+        case ALGO_SURPASS:  fib_surpass_walk(&e->l, e->plan, q->n); mpz_set(q->result, e->l.fk); break;
+        case ALGO_LUCAS:    fib_lucas_into(q->result, q->n); break;
+        case ALGO_MATRIX:   fib_matrix_into(q->result, q->n); break;
+        default:            batch_adv(e, q->n, q->result); break;
+    }
+    __atomic_store_n(&q->is_done, true, __ATOMIC_RELEASE);
+}
+
+static void batch_print_ready(batch_t *b)
+{
+    for (; b->next_to_print < b->n_queries && __atomic_load_n(&b->by_line[b->next_to_print]->is_done, __ATOMIC_ACQUIRE); b->next_to_print++)
+    {
+        batch_query_t *q = b->by_line[b->next_to_print];
+        if (b->is_printing) fib_print(q->result);
+        mpz_clear(q->result);
+    }
+}
+
+static void batch_chunk_task(void *ctx, size_t chunk)
+{
+    batch_t *b = ctx;
+    size_t first = b->chunk_first[chunk], last = b->chunk_first[chunk + 1];
+    uint64_t max_n = 0;
+    for (size_t i = first; i < last; i++) if (b->queries[i].n > max_n) max_n = b->queries[i].n;
+
+    batch_engine_t e;
+    batch_engine_init(&e, max_n);
+    for (size_t i = first; i < last; i++)
+    {
+        batch_answer(&e, &b->queries[i]);
+        if (b->is_streaming) batch_print_ready(b);
+    }
+    batch_engine_clear(&e);
+}
+
+static int batch_query_order(const void *x, const void *y)
+{
+    const batch_query_t *a = x, *b = y;
+    if (a->algo != b->algo) return a->algo < b->algo ? -1 : 1;
+    return a->n < b->n ? -1 : a->n > b->n;
+}
+
+int fib_batch(const char *default_algo, bool is_default_named, bool is_printing)
+{
+    batch_t b = { .is_printing = is_printing };
+    size_t capacity = 0, line_number = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+
+    while (getline(&line, &line_size, stdin) != -1)
+    {
+        line_number++;
+        char index_text[32], algo_text[32], extra[2];
+        int n_fields = sscanf(line, "%31s %31s %1s", index_text, algo_text, extra);
+        if (n_fields <= 0) continue;  // blank line
+        if (n_fields > 2) return fprintf(stderr, "Batch line %zu: expected '<index>' or '<index> <algo>'\n", line_number), 1;
+
+        char *endptr;
+        errno = 0;
+        uint64_t index = strtoull(index_text, &endptr, 10);
+        if (index_text[0] == '-' || *endptr != '\0' || errno != 0 || index == 0)
+            return fprintf(stderr, "Batch line %zu: index must be a positive integer: %s\n", line_number, index_text), 1;
+        const char *algo_name = n_fields == 2 ? algo_text : default_algo;
+        bool is_auto = strcmp(algo_name, "auto") == 0;
+        int algo = fib_algo_from_name(is_auto ? fib_auto_pick(index) : algo_name);
+        if (algo < 0) return fprintf(stderr, "Batch line %zu: unrecognized algorithm: '%s'. Valid algorithms: naive straight adv surpass lucas matrix lean auto\n", line_number, algo_text), 1;
+
+        if (b.n_queries == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 1024;
+            b.queries = realloc(b.queries, capacity * sizeof(batch_query_t));
+        }
+        bool is_shortcut_ok = is_auto || (n_fields == 1 && !is_default_named);
+        b.queries[b.n_queries] = (batch_query_t){ .n = index, .algo = algo, .is_shortcut_ok = is_shortcut_ok, .line = b.n_queries };
+        b.n_queries++;
+    }
+    free(line);
+    if (b.n_queries == 0) return 0;
+
+    qsort(b.queries, b.n_queries, sizeof(batch_query_t), batch_query_order);
+    b.by_line = malloc(b.n_queries * sizeof(batch_query_t *));
+    for (size_t i = 0; i < b.n_queries; i++) b.by_line[b.queries[i].line] = &b.queries[i];
+
+    // split into runs of about equal work when the threads go to whole queries
+    size_t n_chunks = (size_t)pool_threads() <= b.n_queries ? (size_t)pool_threads() : 1;
+    b.chunk_first = malloc((n_chunks + 1) * sizeof(size_t));
+    double total_work = 0, work = 0;
+    for (size_t i = 0; i < b.n_queries; i++) total_work += fib_bits(b.queries[i].n);
+    b.chunk_first[0] = 0;
+    b.chunk_first[n_chunks] = b.n_queries;
+    for (size_t chunk = 1, i = 0; chunk < n_chunks; chunk++)
     {
-        mpz_pow_ui(fffk, fk, 3);    // f(k)^3
-        mpz_mul_ui(fffk, fffk, 5);  // 5*f(k)^3
-        
-        mpz_mul_ui(fk, fk, 3);  // 3*F(k)
-        mpz_sub(fk, fffk, fk);  // 5*F(k)^3 - 3*F(k)
+        while (i < b.n_queries && work < total_work * chunk / n_chunks) work += fib_bits(b.queries[i++].n);
+        b.chunk_first[chunk] = i;
     }
-    
-    // printing
-    if (is_printing) gmp_printf("%Zd\n", fk);
-    
-    // // cleanup
-    mpz_clear(fk);
-    mpz_clear(fffk);
+
+    b.is_streaming = n_chunks == 1;  // threaded chunks finish out of order, so they print at the end, from one thread
+    if (n_chunks == 1) batch_chunk_task(&b, 0);
+    else pool_run(fib_pool, batch_chunk_task, &b, n_chunks);
+    batch_print_ready(&b);
+
+    free(b.chunk_first);
+    free(b.by_line);
+    free(b.queries);
+    return 0;
 }
 
-// find by finding fibo(k/2) (and find that through fibo(k/4)...)
-// Then find F(k) = F(2x) = F(x) * (2*F(x+1) - F(x))  and  F(k+1) = F(2x+1) = F(x+1)^2 + F(x)^2
-// Basically we're multiplying by 2 and adding 1 according to the binary representation of the sought index
-void fib_adv(uint64_t n, bool is_printing)
+
+// Benchmark mode (--bench <runs>). Times the chosen algorithm in-process at n = 1, 3, 9... up to the given index (the same
+// sweep compare_runtime.sh makes), so the numbers are the calculation alone: no exec, dynamic linking, or shell around it.
+// Each index gets --warmup untimed runs, then <runs> timed ones. Prints one JSON object per line per statistic, in the shape
+// plot_results.py reads:  {"C_adv_median": [ {"1":"0.000000052"}, {"3":"0.000000061"}, ... ]}
+// --perf adds cycle and instruction counts (calling thread only, so --threads workers aren't included).
+typedef struct {
+    int runs, warmups;
+    int pin_cpu;        // -1 for no pinning
+    bool is_perf;
+} bench_options_t;
+
+// pins the process before the worker pool exists, so the workers inherit it
+int bench_pin(int cpu)
 {
-    mpz_t fk, fk1, fk1k, twofk1k, ffk, ffk1, f2k1;
-    mpz_init_set_ui(fk, 0);    // F(k)  // at index 0, but we start from index 1, so we'll never get back 0
-    mpz_init_set_ui(fk1, 1);   // F(k+1)
-    mpz_init_set_ui(fk1k, 1);  // F(k+1)F(k)
-    mpz_init_set_ui(twofk1k, 1);  // 2*F(k+1)F(k)
-    mpz_init_set_ui(ffk, 1);   // F(k)^2
-    mpz_init_set_ui(ffk1, 1);  // F(k+1)^2
-    mpz_init_set_ui(f2k1, 1);  // F(2k+1)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) return fprintf(stderr, "Can't pin to CPU %d: %s\n", cpu, strerror(errno)), 1;
+    return 0;
+}
 
-    // create a number that we can iterate on its bits in reverse order
-    uint64_t inverted_n = 0;
-    int bits_in_n = 0;  // count how many bits n has
-    for (uint64_t n_copy = n ; n_copy > 0 ; n_copy >>= 1)
+static double bench_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);  // not slewed by NTP mid-measurement
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int bench_perf_open(uint64_t config)
+{
+    struct perf_event_attr attr = { .type = PERF_TYPE_HARDWARE, .size = sizeof(attr), .config = config, .disabled = 1, .exclude_kernel = 1, .exclude_hv = 1 };
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);  // this thread, any CPU
+}
+
+static int bench_compare_double(const void *x, const void *y) { double a = *(const double *)x, b = *(const double *)y; return (a > b) - (a < b); }
+
+// sorts the samples; values are min, median, p95
+static void bench_stats(double *samples, int n, double out[3])
+{
+    qsort(samples, n, sizeof(double), bench_compare_double);
+    out[0] = samples[0];
+    out[1] = n % 2 ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+    int p95 = (95 * n + 99) / 100 - 1;  // nearest rank
+    out[2] = samples[p95 < 0 ? 0 : p95];
+}
+
+int fib_bench(const char *algo, uint64_t max_index, const bench_options_t *opts)
+{
+    static const char *stat_names[] = { "min", "median", "p95", "cycles", "instructions" };
+    enum { N_STATS = 5, MAX_POINTS = 41 };  // 3^40 is the last power of 3 below 2^64
+
+    int perf_fds[2] = { -1, -1 };
+    if (opts->is_perf)
     {
-        inverted_n <<= 1;
-        if (n_copy & 1) inverted_n++;  // for every 1 we take out of n, we put one in its inversion (from the other direction)
-        bits_in_n++;
+        perf_fds[0] = bench_perf_open(PERF_COUNT_HW_CPU_CYCLES);
+        perf_fds[1] = bench_perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+        if (perf_fds[0] < 0 || perf_fds[1] < 0)
+        {
+            fprintf(stderr, "perf_event_open failed (%s), timing only. Check /proc/sys/kernel/perf_event_paranoid\n", strerror(errno));
+            for (int i = 0; i < 2; i++) if (perf_fds[i] >= 0) close(perf_fds[i]);
+            perf_fds[0] = perf_fds[1] = -1;
+        }
     }
-    
-    #ifdef TESTING  // only for development, don't compile with -DTESTING on the regular
-        int fibonacci[] = {0, 1, 1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597, 2584, 4181, 6765, 10946, 17711, 28657, 46368, 75025, 121393, 196418, 317811, 514229, 832040, 1346269, 2178309, 3524578, 5702887, 9227465, 14930352, 24157817, 39088169, 63245986, 102334155, 165580141, 267914296, 433494437, 701408733, 1134903170, 1836311903};
-        size_t fibsize = sizeof(fibonacci) / sizeof(fibonacci[0]);
-        int prev_k=(int)mpz_get_ui(fk), prev_k1=(int)mpz_get_ui(fk1);
-        int k = 0;
-        
-        void check_valid(char *thing_checked, int supposed, int calculated, int k, bool *is_passed)
+    bool is_counting = perf_fds[0] >= 0;
+
+    double *times = malloc(opts->runs * sizeof(double)), *counts[2] = { malloc(opts->runs * sizeof(double)), malloc(opts->runs * sizeof(double)) };
+    double results[MAX_POINTS][N_STATS];
+    uint64_t indices[MAX_POINTS];
+    int n_points = 0;
+
+    bool is_auto = strcmp(algo, "auto") == 0;
+    for (uint64_t n = 1; n_points < MAX_POINTS; n *= 3)
+    {
+        // the engine itself, like --calibrate times it: the small-index shortcuts would time the same table for everyone
+        const fib_algo_t *engine = &fib_algos[fib_algo_from_name(is_auto ? fib_auto_pick(n) : algo)];
+        for (int i = 0; i < opts->warmups; i++) engine->run(n, false);
+        for (int i = 0; i < opts->runs; i++)
         {
-            if (supposed != calculated)
-            { 
-                printf("At k=%d, incorrect calculation of %s. Supposed to be %d, got %d.\n", k, thing_checked, supposed, calculated);
-                *is_passed=false;
-            }
+            if (is_counting) for (int c = 0; c < 2; c++) { ioctl(perf_fds[c], PERF_EVENT_IOC_RESET, 0); ioctl(perf_fds[c], PERF_EVENT_IOC_ENABLE, 0); }
+            double start = bench_now();
+            engine->run(n, false);
+            times[i] = bench_now() - start;
+            if (is_counting)
+                for (int c = 0; c < 2; c++)
+                {
+                    uint64_t count = 0;
+                    ioctl(perf_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(perf_fds[c], &count, sizeof(count)) != sizeof(count)) count = 0;
+                    counts[c][i] = (double)count;
+                }
         }
-    #endif
 
-    // for each bit of inverted n (or: for each bit in n, from MSB to LSB), until (including) our location matches the original goal
-    bool is_last_even = true;  // start on 0 digit beyond MSB (first bit will always be 1, so we know it'll flip in first iteration)
-    for (int bitnum = 0 ; bitnum < bits_in_n ; bitnum++, inverted_n >>= 1)
-    {
-        //  F(2k+1)
-        mpz_mul(ffk, fk, fk);      // F(k)^2
-        // We also need F(k+1)^2 but instead of wasting time on squaring it directly, I found a way that'd let us cache a different value for later:  F(k+1)^2 = F(k+1)*F(k) + F(k)^2 + (-1)^k
-        mpz_mul(fk1k, fk1, fk);    // F(k+1)F(k)
-        mpz_add(ffk1, fk1k, ffk);  // F(k+1)F(k) + F(k)^2
-        if(is_last_even) mpz_add_ui(ffk1, ffk1, 1); else mpz_sub_ui(ffk1, ffk1, 1);  // F(k+1)^2 = F(k+1)*F(k) + F(k)^2 + (-1)^k
-        mpz_add(f2k1, ffk1, ffk);  // F(2k+1) = F(k+1)^2 + F(k)^2
-        mpz_add(twofk1k, fk1k, fk1k);  // 2*F(k+1)F(k)
-         
-        // at this point, it'd be good to make no mure multiplications.
-        // Available values are: F(k), F(k+1), F(k)^2 , F(k+1)F(k) , F(2k+1)
-        
-        // use all gathered data to jump to x2 index
-        if (inverted_n & 1)  // uneven, progress fibo by extra 1. All according to the bits of n.
-        {
-            //  F(k+1) <- F(2k+2)
-            // F(2k+2) = F(2k+1) + 2*F(k+1)F(k) - F(k)^2   // I don't remember how I got this formula. "It just works" -Todd Howard
-            // F(2k+2) = F(k+1)^2 + 2*F(k+1)F(k)  // shorter
-            // Could also run longer through Cassini's:  F(2k+2) = F(k+2)^2 - F(k)^2
-            mpz_add(fk1, ffk1, twofk1k);    // F(2k+2) = F(k+1)^2 + 2*F(k+1)F(k)
-            
-            //  F(k) <- F(2k+1)
-            mpz_swap(fk, f2k1);
-            
-            is_last_even=false;
+        indices[n_points] = n;
+        bench_stats(times, opts->runs, results[n_points]);
+        for (int c = 0; c < 2 && is_counting; c++)
+        {
+            double count_stats[3];
+            bench_stats(counts[c], opts->runs, count_stats);
+            results[n_points][3 + c] = count_stats[1];  // median
         }
-        else  // even. get 2k and 2k+1, no incrementation
+        n_points++;
+        if (n > max_index / 3) break;
+    }
+
+    for (int stat = 0; stat < (is_counting ? N_STATS : 3); stat++)
+    {
+        printf("{\"C_%s_%s\": [", algo, stat_names[stat]);
+        for (int p = 0; p < n_points; p++)
+            printf(stat < 3 ? "%s {\"%llu\":\"%.9f\"}" : "%s {\"%llu\":\"%.0f\"}", p ? "," : "", (unsigned long long)indices[p], results[p][stat]);
+        printf(" ]}\n");
+    }
+
+    free(times);
+    free(counts[0]);
+    free(counts[1]);
+    for (int i = 0; i < 2; i++) if (perf_fds[i] >= 0) close(perf_fds[i]);
+    return 0;
+}
+
+
+// Modular mode (--mod M). Only F(n) mod M is wanted, so the adv ladder (see fib_ladder_double) runs on residues: a step
+// costs a few word operations, or a few M-sized mpz ones, however big F(n) would be. n can then be any decimal number too;
+// it's walked bit by bit out of an mpz.
+// M up to 64 bits: its odd part goes through Montgomery arithmetic, its power of 2 part through plain wrap-around uint64_t
+// arithmetic, and the two residues are put back together with the CRT. Larger M: mpz with Barrett reduction.
+// F mod M repeats with the Pisano period pi(M), so if M factors by trial division (what's left being 1 or a prime), n is
+// first reduced mod a multiple of pi(M): pi(p^e) divides p^(e-1) * pi(p), and pi(p) divides 3 for p = 2, 20 for p = 5,
+// p-1 for p = +-1 mod 10 and 2(p+1) for p = +-3 mod 10. That leaves the ladder about as many steps as M has bits.
+#define MOD_TRIAL_LIMIT 65536
+
+// a multiple of pi(prime^e), by the divisibilities above
+static void mod_pisano_prime_power(mpz_ptr out, mpz_srcptr prime, unsigned long e)
+{
+    unsigned long last_digit = mpz_fdiv_ui(prime, 10);
+    if (mpz_cmp_ui(prime, 2) == 0) mpz_set_ui(out, 3);
+    else if (mpz_cmp_ui(prime, 5) == 0) mpz_set_ui(out, 20);
+    else if (last_digit == 1 || last_digit == 9) mpz_sub_ui(out, prime, 1);
+    else { mpz_add_ui(out, prime, 1); mpz_mul_2exp(out, out, 1); }
+    for (unsigned long i = 1; i < e; i++) mpz_mul(out, out, prime);
+}
+
+// a multiple of pi(m) in period, or 0 when m doesn't factor easily
+static void mod_pisano_multiple(mpz_ptr period, mpz_srcptr m)
+{
+    mpz_t rest, prime, part;
+    mpz_inits(rest, prime, part, NULL);
+    mpz_set(rest, m);
+    mpz_set_ui(period, 1);
+
+    bool is_rest_prime = mpz_probab_prime_p(rest, 30);
+    for (unsigned long d = 2; !is_rest_prime && mpz_cmp_ui(rest, 1) > 0 && d < MOD_TRIAL_LIMIT; d += (d == 2 ? 1 : 2))
+    {
+        if (!mpz_divisible_ui_p(rest, d)) continue;
+        unsigned long e = 0;
+        for (; mpz_divisible_ui_p(rest, d); e++) mpz_divexact_ui(rest, rest, d);
+        mpz_set_ui(prime, d);
+        mod_pisano_prime_power(part, prime, e);
+        mpz_lcm(period, period, part);
+        is_rest_prime = mpz_probab_prime_p(rest, 30);
+    }
+    if (mpz_cmp_ui(rest, 1) > 0)
+    {
+        if (is_rest_prime)
         {
-            //  F(k) <- F(2k)
-            // F(2k) = F(k+1)^2 + F(k+1)*F(k) - 2*F(k)^2 - (-1)^k  // a mix of various; Catalan's, Cassini's, and some of mine.
-            // Could also run longer through Cassini's:  F(2k) = F(k+1)^2 - F(k-1)^2
-            // or back to F(2k) = 2*F(k+1)F(k) - F(k)^2
-            mpz_sub(fk, twofk1k, ffk);    // F(2k) = 2*F(k+1)F(k) - F(k)^2
+            mod_pisano_prime_power(part, rest, 1);
+            mpz_lcm(period, period, part);
+        }
+        else mpz_set_ui(period, 0);
+    }
+    mpz_clears(rest, prime, part, NULL);
+}
 
-            //  F(k+1) <- F(2k+1)
-            mpz_swap(fk1, f2k1);
-            
-            is_last_even=true;
+
+// Montgomery arithmetic mod an odd m < 2^64, R = 2^64. Values are kept as x*R mod m.
+typedef struct {
+    uint64_t m;
+    uint64_t m_inv;     // m^-1 mod 2^64
+    uint64_t r1;        // R mod m, i.e. 1 in Montgomery form
+} mont64_t;
+
+static mont64_t mont64_init(uint64_t m)
+{
+    uint64_t inv = m;  // right to 3 bits for odd m, every Newton step doubles that
+    for (int i = 0; i < 5; i++) inv *= 2 - m * inv;
+    return (mont64_t){ .m = m, .m_inv = inv, .r1 = (0 - m) % m };
+}
+
+static inline uint64_t mod64_add(uint64_t a, uint64_t b, uint64_t m) { return a >= m - b ? a - (m - b) : a + b; }
+static inline uint64_t mod64_sub(uint64_t a, uint64_t b, uint64_t m) { return a >= b ? a - b : a - b + m; }
+
+// a*b/R mod m, for a, b < m. q*m has the same low half as a*b, so only the high halves get subtracted (no carry out
+// of 128 bits, even with m above 2^63)
+static inline uint64_t mont64_mul(const mont64_t *mt, uint64_t a, uint64_t b)
+{
+    unsigned __int128 t = (unsigned __int128)a * b;
+    uint64_t q = (uint64_t)t * mt->m_inv;
+    uint64_t t_hi = (uint64_t)(t >> 64), qm_hi = (uint64_t)(((unsigned __int128)q * mt->m) >> 64);
+    return t_hi >= qm_hi ? t_hi - qm_hi : t_hi - qm_hi + mt->m;
+}
+
+// F(n) mod m, the ladder in Montgomery form
+static uint64_t mod_ladder_mont(const mont64_t *mt, mpz_srcptr n)
+{
+    uint64_t m = mt->m, a = 0, b = mt->r1;  // F(0), F(1)
+    for (size_t bit = mpz_sizeinbase(n, 2); bit-- > 0; )
+    {
+        uint64_t f2k = mont64_mul(mt, a, mod64_sub(mod64_add(b, b, m), a, m));          // F(k) * (2F(k+1) - F(k))
+        uint64_t f2k1 = mod64_add(mont64_mul(mt, a, a), mont64_mul(mt, b, b), m);       // F(k)^2 + F(k+1)^2
+        if (mpz_tstbit(n, bit)) { a = f2k1; b = mod64_add(f2k, f2k1, m); }
+        else { a = f2k; b = f2k1; }
+    }
+    return mont64_mul(mt, a, 1);
+}
+
+// F(n) mod 2^64: the same ladder, letting uint64_t wrap
+static uint64_t mod_ladder_wrap(mpz_srcptr n)
+{
+    uint64_t a = 0, b = 1;
+    for (size_t bit = mpz_sizeinbase(n, 2); bit-- > 0; )
+    {
+        uint64_t f2k = a * (2 * b - a), f2k1 = a * a + b * b;
+        if (mpz_tstbit(n, bit)) { a = f2k1; b = f2k + f2k1; }
+        else { a = f2k; b = f2k1; }
+    }
+    return a;
+}
+
+// M = m * 2^s with m odd: F(n) mod m and mod 2^s, joined as x = r_m + m * ((r_2 - r_m) * m^-1 mod 2^s)
+static uint64_t mod_word(uint64_t modulus, mpz_srcptr n)
+{
+    int s = __builtin_ctzll(modulus);
+    mont64_t mt = mont64_init(modulus >> s);
+    uint64_t r_m = mod_ladder_mont(&mt, n);
+    uint64_t r_2 = s ? mod_ladder_wrap(n) : 0, mask = ((uint64_t)1 << s) - 1;
+    return r_m + mt.m * (((r_2 - r_m) * mt.m_inv) & mask);
+}
+
+
+// Barrett reduction mod m of k bits: for x < 2^2k, q = ((x >> (k-1)) * mu) >> (k+1) with mu = 2^2k / m is at most 2 below
+// x / m, so x - q*m needs at most two more subtractions
+typedef struct {
+    mpz_t m, mu, q;
+    size_t k;
+} barrett_t;
+
+static void barrett_reduce(barrett_t *br, mpz_ptr x)
+{
+    mpz_tdiv_q_2exp(br->q, x, br->k - 1);
+    mpz_mul(br->q, br->q, br->mu);
+    mpz_tdiv_q_2exp(br->q, br->q, br->k + 1);
+    mpz_submul(x, br->q, br->m);
+    while (mpz_cmp(x, br->m) >= 0) mpz_sub(x, x, br->m);
+}
+
+// F(n) mod m into result, the ladder on mpz residues
+static void mod_ladder_barrett(mpz_ptr result, mpz_srcptr m, mpz_srcptr n)
+{
+    barrett_t br;
+    mpz_inits(br.m, br.mu, br.q, NULL);
+    mpz_set(br.m, m);
+    br.k = mpz_sizeinbase(m, 2);
+    mpz_setbit(br.mu, 2 * br.k);
+    mpz_tdiv_q(br.mu, br.mu, m);
+
+    mpz_t a, b, f2k, f2k1;
+    mpz_inits(a, b, f2k, f2k1, NULL);
+    mpz_set_ui(b, 1);
+    for (size_t bit = mpz_sizeinbase(n, 2); bit-- > 0; )
+    {
+        mpz_mul_2exp(f2k, b, 1);                            // 2F(k+1) - F(k), in (-m, 2m)
+        mpz_sub(f2k, f2k, a);
+        if (mpz_sgn(f2k) < 0) mpz_add(f2k, f2k, m); else if (mpz_cmp(f2k, m) >= 0) mpz_sub(f2k, f2k, m);
+        mpz_mul(f2k, f2k, a);
+        barrett_reduce(&br, f2k);
+        mpz_mul(a, a, a);                                   // each square reduced alone: their sum can pass 2^2k
+        barrett_reduce(&br, a);
+        mpz_mul(f2k1, b, b);
+        barrett_reduce(&br, f2k1);
+        mpz_add(f2k1, f2k1, a);
+        if (mpz_cmp(f2k1, m) >= 0) mpz_sub(f2k1, f2k1, m);
+
+        if (mpz_tstbit(n, bit))
+        {
+            mpz_add(b, f2k, f2k1);
+            if (mpz_cmp(b, m) >= 0) mpz_sub(b, b, m);
+            mpz_swap(a, f2k1);
         }
+        else { mpz_swap(a, f2k); mpz_swap(b, f2k1); }
+    }
+    mpz_set(result, a);
+    mpz_clears(a, b, f2k, f2k1, br.m, br.mu, br.q, NULL);
+}
 
-        #ifdef TESTING
-            bool is_fine = true;
-            printf("Did %s iteration. ", is_last_even? "even":"uneven");
-            if ((k+1)*(k+1) < fibsize)
-            {
-                gmp_printf("Values: %d,%d -> %Zd,%Zd\n", prev_k, prev_k1, fk, fk1);
-                check_valid("F(k)",         fibonacci[k], prev_k,               k, &is_fine);
-                check_valid("F(k+1)",       fibonacci[k+1], prev_k1,            k, &is_fine);
-                check_valid("F(k+1)F(k)",   prev_k*prev_k1, mpz_get_ui(fk1k),   k, &is_fine);
-                check_valid("F(k)^2",       prev_k*prev_k, mpz_get_ui(ffk),     k, &is_fine);
-                check_valid("F(k+1)^2",     prev_k1*prev_k1, mpz_get_ui(ffk1),  k, &is_fine);
-                
-                k *= 2;
-                if (!is_last_even) k++;
-                prev_k=(int)mpz_get_ui(fk), prev_k1=(int)mpz_get_ui(fk1);
-                
-                check_valid("Next F(k)",         fibonacci[k], prev_k,          k, &is_fine);  // checked twice, but I don't care.
-                check_valid("Next F(k+1)",       fibonacci[k+1], prev_k1,       k, &is_fine);
-                
-                if (!is_fine) exit(1);
-            }
-            else
-            {
-                gmp_printf("Can't check efficiently. Exceeded cached Fibonacci values. Current values: %Zd,%Zd\n", fk, fk1);
-            }
-        #endif
+static bool is_decimal(const char *s) { return s[0] != '\0' && strspn(s, "0123456789") == strlen(s); }
+
+int fib_mod(const char *index_str, const char *modulus_str, bool is_printing)
+{
+    if (!is_decimal(index_str)) return fprintf(stderr, "Index is invalid as an integer: %s\n", index_str), 1;
+    if (!is_decimal(modulus_str)) return fprintf(stderr, "Modulus must be a positive integer: %s\n", modulus_str), 1;
+
+    mpz_t n, m, period, result;
+    mpz_inits(n, m, period, result, NULL);
+    mpz_set_str(n, index_str, 10);
+    mpz_set_str(m, modulus_str, 10);
+    int status = 1;
+    if (mpz_sgn(n) == 0) fprintf(stderr, "Index must be a positive integer\n");
+    else if (mpz_sgn(m) == 0) fprintf(stderr, "Modulus must be a positive integer: %s\n", modulus_str);
+    else
+    {
+        mod_pisano_multiple(period, m);
+        if (mpz_sgn(period) > 0 && mpz_cmp(n, period) >= 0) mpz_mod(n, n, period);
+
+        if (mpz_sizeinbase(m, 2) <= 64) mpz_set_ui(result, mod_word(mpz_get_ui(m), n));
+        else mod_ladder_barrett(result, m, n);
+        if (is_printing) fib_print(result);
+        status = 0;
     }
-    
-    // printing
-    if (is_printing) gmp_printf("%Zd\n", fk);  // print trailing item
-    
-    // // cleanup
-    mpz_clear(fk);
-    mpz_clear(fk1);
-    mpz_clear(ffk);
-    mpz_clear(fk1k);
-    mpz_clear(twofk1k);
-    mpz_clear(ffk1);
-    mpz_clear(f2k1);
+    mpz_clears(n, m, period, result, NULL);
+    return status;
 }
 
 
+// Digit count and leading digits (--digits, --leading K), without F(n) itself. Binet: F(n) = (phi^n - psi^n)/sqrt(5), and
+// |psi^n| < 1, so F(n) = phi^n/sqrt(5) * (1 + r) with |r| < phi^-2n. That's taken in mpf to p bits, written as m * 10^D
+// with 1 <= m < 10, and D+1 is the digit count and floor(m * 10^(K-1)) the leading K digits.
+// Error bound: mpf truncates every result, so each operation is off by a relative u = 2^(1-p) at most. phi carries 2u,
+// which phi^n turns into 2n*u; the powerings take one u per multiplication, two per bit of the exponent; the rest is a few
+// more u. To first order, t = m * 10^(K-1) is then within |t| * E of the truth, with
+// E = 2 * (2n + 2 bits(n) + 2 bits(D) + 2 bits(K) + 5) * u + phi^-2n  (the 2 covers second-order terms and the truncated
+// arithmetic of the bound itself).
+// If floor(t(1-E)) and floor(t(1+E)) disagree, the digits aren't settled: double p and try again, and after a few rounds
+// (or for small n, or when K covers all of F(n)) compute F(n) exactly.
+#define DIGITS_TRIES 3
 
-void fib_straight(uint64_t index, bool is_printing)
+// F(n) and its digits the slow way. Exact at any n that fits in memory.
+static void digits_exact(uint64_t n, uint64_t k, uint64_t *digits, mpz_ptr leading)
 {
-    mpz_t trailing, leading;
-    mpz_init_set_ui(trailing, 1);
-    mpz_init_set_ui(leading, 1);
+    mpz_t x, power;
+    mpz_inits(x, power, NULL);
+    fib_lucas_into(x, n);
+    uint64_t d = mpz_sizeinbase(x, 10);  // exact or one too many
+    mpz_ui_pow_ui(power, 10, d - 1);
+    if (d > 1 && mpz_cmp(x, power) < 0) d--;
+    *digits = d;
+    if (d > k) { mpz_ui_pow_ui(power, 10, d - k); mpz_tdiv_q(leading, x, power); }
+    else mpz_set(leading, x);
+    mpz_clears(x, power, NULL);
+}
 
-    // calculation
-    for (uint64_t i = 3; i <= index; ++i)  // we want to include index, so we use <=
+static size_t digits_bit_length(uint64_t x) { return x ? 64 - __builtin_clzll(x) : 0; }
+
+// one Binet attempt at p bits; false if the bound can't settle the digits
+static bool digits_binet(uint64_t n, uint64_t k, mp_bitcnt_t p, uint64_t *digits, mpz_ptr leading)
+{
+    mpf_t phi, sqrt5, t, power, err, bound;
+    mpf_set_default_prec(p);
+    mpf_inits(phi, sqrt5, t, power, err, bound, NULL);
+    p = mpf_get_prec(phi);  // GMP rounds p up to whole limbs
+
+    mpf_sqrt_ui(sqrt5, 5);
+    mpf_add_ui(phi, sqrt5, 1);
+    mpf_div_2exp(phi, phi, 1);
+    mpf_pow_ui(t, phi, n);
+    mpf_div(t, t, sqrt5);                                   // ~ F(n)
+
+    // D from log10(F(n)) ~ n log10(phi) - log10(sqrt(5)) in long double; off by one at worst, which the checks below fix
+    uint64_t d = (uint64_t)((long double)n * 0.20898764024997873376927L - 0.34948500216800940239314L);
+    bool is_settled = false, is_done = false;
+    for (int tries = 0; tries < 3 && !is_done; tries++)
     {
-        mpz_swap(trailing, leading);          // f(k) = f(k+1)
-        mpz_add(leading, trailing, leading);  // f(k+1) = f(k+1) + f(k)
+        mpf_set_ui(power, 10);
+        mpf_pow_ui(power, power, d);
+        mpf_div(bound, t, power);                           // m
+        mpf_set_ui(power, 10);
+        mpf_pow_ui(power, power, k - 1);
+        mpf_mul(bound, bound, power);                       // m * 10^(K-1)
+
+        mpf_set_ui(err, n);                                 // E, see above
+        mpf_mul_2exp(err, err, 1);
+        mpf_add_ui(err, err, 2 * (digits_bit_length(n) + digits_bit_length(d) + digits_bit_length(k)) + 5);
+        mpf_div_2exp(err, err, p - 2);
+        if (1.388 * (double)n < (double)p + 64) { mpf_set_ui(power, 1); mpf_div_2exp(power, power, (mp_bitcnt_t)(1.388 * (double)n)); mpf_add(err, err, power); }
+
+        mpz_t lo, hi, low_end, high_end;
+        mpz_inits(lo, hi, low_end, high_end, NULL);
+        mpf_ui_sub(power, 1, err);
+        mpf_mul(power, power, bound);
+        mpz_set_f(lo, power);
+        mpf_add_ui(power, err, 1);
+        mpf_mul(power, power, bound);
+        mpz_set_f(hi, power);
+
+        mpz_ui_pow_ui(low_end, 10, k - 1);                  // with the right D, the leading K digits are in [10^(K-1), 10^K)
+        mpz_mul_ui(high_end, low_end, 10);
+        if (mpz_cmp(hi, low_end) < 0) d--;
+        else if (mpz_cmp(lo, high_end) >= 0) d++;
+        else
+        {
+            is_settled = mpz_cmp(lo, hi) == 0 && mpz_cmp(lo, low_end) >= 0 && mpz_cmp(hi, high_end) < 0;
+            if (is_settled) mpz_set(leading, lo);
+            is_done = true;  // D is right, or the bound straddles a power of 10: either way, done at this p
+        }
+        mpz_clears(lo, hi, low_end, high_end, NULL);
     }
+    mpf_clears(phi, sqrt5, t, power, err, bound, NULL);
+    *digits = d + 1;
+    return is_settled;
+}
 
-    // printing
-    if (is_printing) gmp_printf("%Zd\n", leading);
+// --digits prints the digit count, --leading K (k > 0) the first K digits (all of F(n) if it has fewer)
+int fib_digits(uint64_t n, uint64_t k, bool is_counting, bool is_printing)
+{
+    uint64_t digits = 0, k_used = k ? k : 1;  // --digits alone: the count falls out of any K
+    mpz_t leading;
+    mpz_init(leading);
 
-    // cleanup
-    mpz_clear(trailing);
+    mp_bitcnt_t p = (mp_bitcnt_t)(3.33 * (double)k_used) + 2 * digits_bit_length(n) + 64;  // ~ K + log10(n) digits, plus the bound's room
+    bool is_settled = false;
+    if (n > FIB_SMALL_MAX && (double)k_used < 0.2089 * (double)n - 1)  // else F(n) has at most ~K digits, no point
+        for (int i = 0; i < DIGITS_TRIES && !is_settled; i++, p *= 2) is_settled = digits_binet(n, k_used, p, &digits, leading);
+    if (!is_settled) digits_exact(n, k_used, &digits, leading);
+
+    if (is_printing && is_counting) fib_print_u128(digits);
+    if (is_printing && k) fib_print(leading);
     mpz_clear(leading);
+    return 0;
 }
 
 
-// mostly copied (not that it's complicated, but the typing is a good idea) from:  https://github.com/SheafificationOfG/Fibsonisheaf/blob/main/impl/naive.c
-void fib_naive(uint64_t index, uint64_t *result)  // uint64_t can store up to Fib[93]=12200160415121876738 . We won't reach 93 in naive solution, so we can keep it simple and efficient
+// Range mode (--range a:b). The adv ladder seeds (F(a), F(a+1)), and from there every value is one addition. Three stages
+// overlap: this thread adds and copies the values into blocks, --threads formatter threads turn whole blocks into text, and a
+// writer thread write()s the blocks' text in order. Blocks go around a fixed ring of slots whose mpz values and text buffers
+// are reused, so once they've grown to the values' size nothing allocates. A block takes consecutive values up to about
+// RANGE_BLOCK_LIMBS limbs, so small values don't pay a hand-off (or a write) each.
+#define RANGE_BLOCK_LIMBS 8192      // 64KiB of limbs, ~160KB of decimal text per write
+#define RANGE_BLOCK_VALUES 1024
+
+typedef enum { RANGE_FREE, RANGE_FILLED, RANGE_FORMATTED } range_slot_state_t;
+
+typedef struct {
+    mpz_t values[RANGE_BLOCK_VALUES];
+    int n_values, n_inited;         // values past n_inited were never initialized
+    char *text;
+    size_t text_len, text_cap;
+    range_slot_state_t state;
+} range_slot_t;
+
+typedef struct {
+    range_slot_t *slots;
+    uint64_t n_slots;
+    uint64_t n_filled, n_claimed, n_written;    // blocks so far, per stage
+    bool is_filling_done;
+    int base;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;                     // any stage moved; blocks are big enough that one condition for all is fine
+} range_t;
+
+// one line per value; mpz_sizeinbase may say one digit too many, so each value gets its count + 2 bytes ('\n' and get_str's '\0')
+static void range_format(range_slot_t *s, int base)
 {
-    if (index <= 2)
+    size_t needed = 0;
+    for (int i = 0; i < s->n_values; i++) needed += mpz_sizeinbase(s->values[i], base) + 2;
+    if (needed > s->text_cap)
     {
-        *result = 1;
-        return;
+        size_t cap = needed > 2 * s->text_cap ? needed : 2 * s->text_cap;
+        char *text = realloc(s->text, cap);
+        if (!text) mem_out_of_memory(cap);
+        s->text = text;
+        s->text_cap = cap;
+    }
+    size_t len = 0;
+    for (int i = 0; i < s->n_values; i++)
+    {
+        mpz_get_str(s->text + len, base, s->values[i]);
+        len += strlen(s->text + len);
+        s->text[len++] = '\n';
     }
+    s->text_len = len;
+}
 
-    uint64_t a, b;
-    fib_naive(index-1, &a);
-    fib_naive(index-2, &b);
-    *result = a + b;
+static void *range_formatter(void *arg)
+{
+    range_t *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;)
+    {
+        while (r->n_claimed == r->n_filled && !r->is_filling_done) pthread_cond_wait(&r->changed, &r->lock);
+        if (r->n_claimed == r->n_filled) break;
+        range_slot_t *s = &r->slots[r->n_claimed++ % r->n_slots];
+        pthread_mutex_unlock(&r->lock);
+        range_format(s, r->base);
+        pthread_mutex_lock(&r->lock);
+        s->state = RANGE_FORMATTED;
+        pthread_cond_broadcast(&r->changed);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
 }
 
-void fib_naive_caller(uint64_t index, bool is_printing)  // the naive method is recursive, so we need an external one
+static void *range_writer(void *arg)
 {
-    uint64_t result;
-    fib_naive(index, &result);
+    range_t *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;)
+    {
+        range_slot_t *s = &r->slots[r->n_written % r->n_slots];
+        bool is_ready = r->n_written < r->n_filled && s->state == RANGE_FORMATTED;
+        if (!is_ready && r->is_filling_done && r->n_written == r->n_filled) break;
+        if (!is_ready) { pthread_cond_wait(&r->changed, &r->lock); continue; }
+        pthread_mutex_unlock(&r->lock);
+        out_write_all(s->text, s->text_len);
+        pthread_mutex_lock(&r->lock);
+        s->state = RANGE_FREE;
+        r->n_written++;
+        pthread_cond_broadcast(&r->changed);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+int fib_range(uint64_t first, uint64_t last, bool is_printing)
+{
+    fib_ladder_t l;
+    fib_ladder_init(&l, last);
+    for (int bit = 63 - __builtin_clzll(first); bit >= 0; bit--) fib_ladder_double(&l, (first >> bit) & 1);  // (F(a), F(a+1))
+
+    if (!is_printing)  // nothing to overlap with
+    {
+        for (uint64_t k = first; k < last; k++) { mpz_add(l.fk, l.fk, l.fk1); mpz_swap(l.fk, l.fk1); }
+        fib_ladder_clear(&l);
+        return 0;
+    }
+
+    int n_formatters = fib_opts.threads > 1 ? fib_opts.threads : 1;
+    range_t r = { .n_slots = 2 * (uint64_t)n_formatters + 2, .base = fib_opts.format == OUT_HEX ? 16 : 10 };
+    r.slots = calloc(r.n_slots, sizeof(range_slot_t));
+    if (!r.slots) mem_out_of_memory(r.n_slots * sizeof(range_slot_t));
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.changed, NULL);
+    pthread_t writer, *formatters = malloc((size_t)n_formatters * sizeof(pthread_t));
+    pthread_create(&writer, NULL, range_writer, &r);
+    for (int i = 0; i < n_formatters; i++) pthread_create(&formatters[i], NULL, range_formatter, &r);
+
+    for (uint64_t k = first; k <= last; )
+    {
+        pthread_mutex_lock(&r.lock);
+        while (r.n_filled - r.n_written == r.n_slots) pthread_cond_wait(&r.changed, &r.lock);
+        pthread_mutex_unlock(&r.lock);
+
+        range_slot_t *s = &r.slots[r.n_filled % r.n_slots];  // written out already, so it's ours until we pass it on
+        size_t limbs = 0;
+        for (s->n_values = 0; k <= last && s->n_values < RANGE_BLOCK_VALUES && limbs < RANGE_BLOCK_LIMBS; s->n_values++, k++)
+        {
+            if (s->n_values == s->n_inited) mpz_init(s->values[s->n_inited++]);
+            mpz_set(s->values[s->n_values], l.fk);
+            limbs += mpz_size(l.fk);
+            mpz_add(l.fk, l.fk, l.fk1);  // (F(k), F(k+1)) -> (F(k+1), F(k+2))
+            mpz_swap(l.fk, l.fk1);
+        }
 
-    if (is_printing) printf("%llu\n", (unsigned long long)result);
+        pthread_mutex_lock(&r.lock);
+        s->state = RANGE_FILLED;
+        r.n_filled++;
+        pthread_cond_broadcast(&r.changed);
+        pthread_mutex_unlock(&r.lock);
+    }
+
+    pthread_mutex_lock(&r.lock);
+    r.is_filling_done = true;
+    pthread_cond_broadcast(&r.changed);
+    pthread_mutex_unlock(&r.lock);
+    for (int i = 0; i < n_formatters; i++) pthread_join(formatters[i], NULL);
+    pthread_join(writer, NULL);
+
+    for (uint64_t i = 0; i < r.n_slots; i++)
+    {
+        for (int j = 0; j < r.slots[i].n_inited; j++) mpz_clear(r.slots[i].values[j]);
+        free(r.slots[i].text);
+    }
+    free(r.slots);
+    free(formatters);
+    pthread_cond_destroy(&r.changed);
+    pthread_mutex_destroy(&r.lock);
+    fib_ladder_clear(&l);
+    return 0;
 }
 
 
@@ -378,10 +3557,30 @@ int print_usage(const char *prog_name, int status) {
         "Calculate nth Fibonacci number, in various ways\n"
         "Usage: %s <args>\n"
         "required args:\n"
-        "<number>                       Fibonacci index to calculate at\n"
+        "<number>                       Fibonacci index to calculate at (unless --batch or --range)\n"
         "optional args:\n"
         "-n                             don't print the calculated result\n"
-        "--algo <naive/straight/adv>    calculation algorithm\n"
+        "--algo <naive/straight/adv/surpass/lucas/matrix/lean/auto>    calculation algorithm (auto: by index, see --calibrate)\n"
+        "--prealloc                     size all big numbers once from the index, no regrowing on the way\n"
+        "--mem-stats                    report allocation count and bytes to stderr\n"
+        "--threads <N>                  spread the big multiplications over N threads\n"
+        "--mul <gmp/ntt>                big-number multiplication backend\n"
+        "--format <dec/hex/raw>         print in decimal (default), hexadecimal, or as raw little-endian bytes\n"
+        "--cache <file>                 resume adv/surpass from checkpoints in file, and add the new ones to it\n"
+        "--batch                        read '<number>' or '<number> <algo>' lines from stdin instead, one result line each\n"
+        "--calibrate                    time the algorithms on this machine and save where each is fastest, for --algo auto\n"
+        "--config <file>                where --calibrate saves and --algo auto reads (default ~/.config/fibo_c.conf)\n"
+        "--bench <runs>                 time <runs> in-process runs at 1, 3, 9... up to <number>, print min/median/p95 as JSON lines\n"
+        "--warmup <runs>                untimed runs before each --bench measurement (default 2)\n"
+        "--pin <cpu>                    with --bench, run on that CPU only\n"
+        "--perf                         with --bench, also count cycles and instructions (perf_event_open)\n"
+        "--mod <M>                      print F(n) mod M instead; <number> and M can then be any size\n"
+        "--mem-limit <size>             keep at most this much of the numbers in RAM (K/M/G/T), the rest in scratch files; --algo defaults to lean\n"
+        "--scratch <dir>                where --mem-limit's files go (default $TMPDIR or /tmp)\n"
+        "--progress                     with --algo lean, report every step and an ETA on stderr\n"
+        "--range <a:b>                  print F(a) to F(b), one per line (no <number> then); --threads sets the formatters\n"
+        "--digits                       print how many decimal digits F(n) has, not F(n)\n"
+        "--leading <K>                  print the first K decimal digits of F(n) (after the count, with --digits)\n"
         "-h / --help                    print this message\n";
     return fprintf(stdout, usage_message, prog_name), status; 
 }
@@ -397,8 +3596,19 @@ int main(int argc, char *argv[])
     // Handling args
     
     uint64_t index = 0;             bool is_set_index = false;
+    const char *index_arg = NULL;
+    const char *modulus_arg = NULL;
+    bool is_digits = false;
+    uint64_t leading_count = 0;
+    uint64_t range_first = 0, range_last = 0;
     bool is_printing = true;        bool is_set_printing = false;
     const char *algo = "adv";       bool is_set_algo = false;
+    bool is_set_mul = false;
+    bool is_set_format = false;
+    bool is_batch = false;
+    bool is_calibrate = false;
+    bench_options_t bench = { .runs = 0, .warmups = 2, .pin_cpu = -1, .is_perf = false };
+    bool is_set_warmup = false;
     const char *set_twice_err = "You tried to set %s more than once!\n";
     
     for (int i = 1; i < argc; i++) 
@@ -415,30 +3625,224 @@ int main(int argc, char *argv[])
         else if (strcmp(argv[i], "--algo") == 0) //algorithm args (optional)
         {
             if (is_set_algo) return fprintf(stderr, set_twice_err, "algorithm"), 1; else is_set_algo = true;
-            if (i + 1 >= argc) return fprintf(stderr, "--algo requires a following argument: naive/straight/adv\n"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--algo requires a following argument: naive/straight/adv/surpass/lucas/matrix/lean/auto\n"), 1;
             
-            if (strcmp(argv[i+1], "naive") == 0 || strcmp(argv[i+1], "straight") == 0 || strcmp(argv[i+1], "adv") == 0 || strcmp(argv[i+1], "surpass") == 0) algo = argv[i+1];
-            else return fprintf(stderr, "Unrecognized algorithm: '%s'. Valid algorithms: naive straight adv surpass\n", argv[i+1]), 1;
+            if (fib_algo_from_name(argv[i+1]) >= 0 || strcmp(argv[i+1], "auto") == 0) algo = argv[i+1];
+            else return fprintf(stderr, "Unrecognized algorithm: '%s'. Valid algorithms: naive straight adv surpass lucas matrix lean auto\n", argv[i+1]), 1;
+            i++;
+        }
+        else if (strcmp(argv[i], "--prealloc") == 0)  // buffer sizing (optional)
+        {
+            if (fib_opts.is_prealloc) return fprintf(stderr, set_twice_err, "preallocation"), 1;
+            fib_opts.is_prealloc = true;
+        }
+        else if (strcmp(argv[i], "--mem-stats") == 0)  // allocation report (optional)
+        {
+            if (fib_opts.is_mem_stats) return fprintf(stderr, set_twice_err, "memory statistics"), 1;
+            fib_opts.is_mem_stats = true;
+        }
+        else if (strcmp(argv[i], "--mul") == 0)  // multiplication backend (optional)
+        {
+            if (is_set_mul) return fprintf(stderr, set_twice_err, "multiplication backend"), 1; else is_set_mul = true;
+            if (i + 1 >= argc) return fprintf(stderr, "--mul requires a following argument: gmp/ntt\n"), 1;
+
+            const mul_backend_t *found = NULL;
+            for (size_t b = 0; b < sizeof(mul_backends) / sizeof(mul_backends[0]); b++) if (strcmp(argv[i+1], mul_backends[b].name) == 0) found = &mul_backends[b];
+            if (!found) return fprintf(stderr, "Unrecognized multiplication backend: '%s'. Valid backends: gmp ntt\n", argv[i+1]), 1;
+            fib_mul_backend = found;
+            i++;
+        }
+        else if (strcmp(argv[i], "--format") == 0)  // output format (optional)
+        {
+            if (is_set_format) return fprintf(stderr, set_twice_err, "output format"), 1; else is_set_format = true;
+            if (i + 1 >= argc) return fprintf(stderr, "--format requires a following argument: dec/hex/raw\n"), 1;
+
+            if (strcmp(argv[i+1], "dec") == 0) fib_opts.format = OUT_DECIMAL;
+            else if (strcmp(argv[i+1], "hex") == 0) fib_opts.format = OUT_HEX;
+            else if (strcmp(argv[i+1], "raw") == 0) fib_opts.format = OUT_RAW;
+            else return fprintf(stderr, "Unrecognized output format: '%s'. Valid formats: dec hex raw\n", argv[i+1]), 1;
+            i++;
+        }
+        else if (strcmp(argv[i], "--batch") == 0)  // indices from stdin (optional)
+        {
+            if (is_batch) return fprintf(stderr, set_twice_err, "batch mode"), 1;
+            is_batch = true;
+        }
+        else if (strcmp(argv[i], "--calibrate") == 0)  // measure --algo auto's thresholds (optional)
+        {
+            if (is_calibrate) return fprintf(stderr, set_twice_err, "calibration"), 1;
+            is_calibrate = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0 || strcmp(argv[i], "--warmup") == 0 || strcmp(argv[i], "--pin") == 0)  // benchmark counts (optional)
+        {
+            bool is_bench = strcmp(argv[i], "--bench") == 0, is_warmup = strcmp(argv[i], "--warmup") == 0;
+            if (is_bench ? bench.runs != 0 : is_warmup ? is_set_warmup : bench.pin_cpu >= 0) return fprintf(stderr, set_twice_err, argv[i]), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "%s requires a following argument: %s\n", argv[i], is_bench || is_warmup ? "run count" : "CPU number"), 1;
+
+            char *endptr;
+            long value = strtol(argv[i+1], &endptr, 10);
+            if (*endptr != '\0' || argv[i+1][0] == '\0' || value < (is_bench ? 1 : 0) || value > 1000000)
+                return fprintf(stderr, "%s must be a%s integer: %s\n", argv[i], is_bench ? " positive" : " non-negative", argv[i+1]), 1;
+            if (is_bench) bench.runs = (int)value;
+            else if (is_warmup) { bench.warmups = (int)value; is_set_warmup = true; }
+            else bench.pin_cpu = (int)value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--perf") == 0)  // hardware counters in --bench (optional)
+        {
+            if (bench.is_perf) return fprintf(stderr, set_twice_err, "--perf"), 1;
+            bench.is_perf = true;
+        }
+        else if (strcmp(argv[i], "--mem-limit") == 0)  // scratch files past this much RAM (optional)
+        {
+            if (fib_opts.mem_limit) return fprintf(stderr, set_twice_err, "memory limit"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--mem-limit requires a following argument: size (like 512M or 4G)\n"), 1;
+
+            char *endptr;
+            errno = 0;
+            unsigned long long size = strtoull(argv[i+1], &endptr, 10);
+            int shift = 0;
+            if (*endptr != '\0' && endptr[1] == '\0')
+                switch (*endptr++) { case 'K': shift = 10; break; case 'M': shift = 20; break; case 'G': shift = 30; break; case 'T': shift = 40; break; default: endptr--; }
+            if (*endptr != '\0' || argv[i+1][0] == '-' || endptr == argv[i+1] || errno != 0 || size == 0 || size > (SIZE_MAX >> shift))
+                return fprintf(stderr, "--mem-limit must be a positive size in bytes, or with a K/M/G/T suffix: %s\n", argv[i+1]), 1;
+            fib_opts.mem_limit = (size_t)size << shift;
+            i++;
+        }
+        else if (strcmp(argv[i], "--scratch") == 0)  // scratch file directory (optional)
+        {
+            if (fib_opts.scratch_dir) return fprintf(stderr, set_twice_err, "scratch directory"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--scratch requires a following argument: directory\n"), 1;
+            fib_opts.scratch_dir = argv[i+1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--progress") == 0)  // per-step report (optional)
+        {
+            if (fib_opts.is_progress) return fprintf(stderr, set_twice_err, "progress report"), 1;
+            fib_opts.is_progress = true;
+        }
+        else if (strcmp(argv[i], "--mod") == 0)  // residue only (optional)
+        {
+            if (modulus_arg) return fprintf(stderr, set_twice_err, "modulus"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--mod requires a following argument: modulus\n"), 1;
+            modulus_arg = argv[i+1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--range") == 0)  // consecutive values (optional)
+        {
+            if (range_first) return fprintf(stderr, set_twice_err, "range"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--range requires a following argument: first:last\n"), 1;
+
+            char *endptr;
+            errno = 0;
+            range_first = strtoull(argv[i+1], &endptr, 10);
+            bool is_valid = argv[i+1][0] != '-' && endptr != argv[i+1] && *endptr == ':' && endptr[1] >= '0' && endptr[1] <= '9';
+            if (is_valid) range_last = strtoull(endptr + 1, &endptr, 10);
+            if (!is_valid || *endptr != '\0' || errno != 0 || range_first == 0 || range_last < range_first)
+                return fprintf(stderr, "--range must be two indices first:last, with 1 <= first <= last: %s\n", argv[i+1]), 1;
+            i++;
+        }
+        else if (strcmp(argv[i], "--digits") == 0)  // digit count only (optional)
+        {
+            if (is_digits) return fprintf(stderr, set_twice_err, "--digits"), 1;
+            is_digits = true;
+        }
+        else if (strcmp(argv[i], "--leading") == 0)  // leading digits only (optional)
+        {
+            if (leading_count) return fprintf(stderr, set_twice_err, "leading digit count"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--leading requires a following argument: digit count\n"), 1;
+
+            char *endptr;
+            errno = 0;
+            leading_count = strtoull(argv[i+1], &endptr, 10);
+            if (*endptr != '\0' || argv[i+1][0] == '\0' || argv[i+1][0] == '-' || errno != 0 || leading_count == 0 || leading_count > 100000000)
+                return fprintf(stderr, "--leading must be an integer between 1 and 100000000: %s\n", argv[i+1]), 1;
+            i++;
+        }
+        else if (strcmp(argv[i], "--config") == 0)  // thresholds file (optional)
+        {
+            if (fib_opts.config_path) return fprintf(stderr, set_twice_err, "config file"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--config requires a following argument: file path\n"), 1;
+            fib_opts.config_path = argv[i+1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--cache") == 0)  // checkpoint file (optional)
+        {
+            if (fib_opts.cache_path) return fprintf(stderr, set_twice_err, "cache file"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--cache requires a following argument: file path\n"), 1;
+            fib_opts.cache_path = argv[i+1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--threads") == 0)  // parallel multiplication (optional)
+        {
+            if (fib_opts.threads) return fprintf(stderr, set_twice_err, "thread count"), 1;
+            if (i + 1 >= argc) return fprintf(stderr, "--threads requires a following argument: thread count\n"), 1;
+
+            char *endptr;
+            long threads = strtol(argv[i+1], &endptr, 10);
+            if (*endptr != '\0' || argv[i+1][0] == '\0' || threads < 1 || threads > 1024) return fprintf(stderr, "Thread count must be an integer between 1 and 1024: %s\n", argv[i+1]), 1;
+            fib_opts.threads = (int)threads;
             i++;
         }
         else  // fibo-index (required) 
         {
             if (is_set_index) return fprintf(stderr, set_twice_err, "fibo-index"), 1; else is_set_index = true;
             if (argv[i][0] == '-') return fprintf(stderr, "Index must be a positive integer\n"), 1;
-
-            char *endptr;
-            index = strtoull(argv[i], &endptr, 10);  // try to convert to base10
-            if (*endptr != '\0' || errno != 0) return fprintf(stderr, "Index is invalid as an integer: %s\n", argv[i]), 1;
-            if (index == 0) return fprintf(stderr, "Index must be a positive integer\n"), 1;
+            index_arg = argv[i];  // parsed below, --mod takes any size
         }
         
     }
 
+    if (fib_opts.mem_limit && !is_set_algo) algo = "lean";
+    if (fib_opts.scratch_dir && !fib_opts.mem_limit) return fprintf(stderr, "--scratch only goes with --mem-limit\n"), 1;
+    if (fib_opts.is_progress && strcmp(algo, "lean") != 0) return fprintf(stderr, "--progress reports on the lean ladder (--algo lean, the default with --mem-limit)\n"), 1;
+    if (range_first && (is_set_index || modulus_arg || is_digits || leading_count || is_batch || is_calibrate || bench.runs || is_set_algo))
+        return fprintf(stderr, "--range takes no index, and doesn't go with --mod, --digits, --leading, --algo, --batch, --calibrate or --bench\n"), 1;
+    if (range_first && fib_opts.format == OUT_RAW) return fprintf(stderr, "--range prints one value per line, so dec or hex only\n"), 1;
+    if ((is_digits || leading_count) && (modulus_arg || is_batch || is_calibrate || bench.runs || is_set_algo || fib_opts.cache_path || is_set_format))
+        return fprintf(stderr, "--digits and --leading work out decimal digits on their own, not with --mod, --algo, --format, --batch, --calibrate, --bench or --cache\n"), 1;
+    if ((is_digits || leading_count) && !is_set_index) return fprintf(stderr, "--digits and --leading need an index\n"), 1;
+    if (modulus_arg)
+    {
+        if (!is_set_index) return fprintf(stderr, "--mod needs an index\n"), 1;
+        if (is_batch || is_calibrate || bench.runs || is_set_algo || fib_opts.cache_path)
+            return fprintf(stderr, "--mod runs its own ladder, not with --algo, --batch, --calibrate, --bench or --cache\n"), 1;
+    }
+    else if (is_set_index)
+    {
+        char *endptr;
+        index = strtoull(index_arg, &endptr, 10);  // try to convert to base10
+        if (*endptr != '\0' || errno != 0) return fprintf(stderr, "Index is invalid as an integer: %s\n", index_arg), 1;
+        if (index == 0) return fprintf(stderr, "Index must be a positive integer\n"), 1;
+    }
+
+    if (is_batch && is_set_index) return fprintf(stderr, "--batch reads the indices from stdin, don't pass one as an argument\n"), 1;
+    if (is_calibrate && (is_set_index || is_batch)) return fprintf(stderr, "--calibrate takes no index\n"), 1;
+    if (bench.runs && !is_set_index) return fprintf(stderr, "--bench needs the largest index to time\n"), 1;
+    if (bench.runs && (is_batch || is_calibrate)) return fprintf(stderr, "--bench runs on its own, not with --batch or --calibrate\n"), 1;
+    if (!bench.runs && (is_set_warmup || bench.pin_cpu >= 0 || bench.is_perf)) return fprintf(stderr, "--warmup, --pin and --perf only go with --bench\n"), 1;
+
     // running program
-    if (strcmp(algo, "naive")==0) fib_naive_caller(index, is_printing);
-    else if (strcmp(algo, "straight")==0) fib_straight(index, is_printing);
-    else if (strcmp(algo, "adv")==0) fib_adv(index, is_printing);
-    else if (strcmp(algo, "surpass")==0) fib_surpass(index, is_printing);
-    
+    if (fib_opts.is_mem_stats || fib_opts.mem_limit || FIB_TRACE_ON) mem_hooks_start();
+    trace_start();
+    if (bench.pin_cpu >= 0 && bench_pin(bench.pin_cpu) != 0) return 1;
+    if (fib_opts.threads > 1) fib_pool = pool_create(fib_opts.threads - 1);
+    if (fib_opts.cache_path) fib_cache_open(fib_opts.cache_path);
+
+    if (strcmp(algo, "auto") == 0 || is_batch) fib_auto_load();  // a batch may ask for auto on any line
+
+    int status = 0;
+    if (modulus_arg) status = fib_mod(index_arg, modulus_arg, is_printing);
+    else if (range_first) status = fib_range(range_first, range_last, is_printing);
+    else if (is_digits || leading_count) status = fib_digits(index, leading_count, is_digits, is_printing);
+    else if (is_calibrate) status = fib_calibrate();
+    else if (is_batch) status = fib_batch(algo, is_set_algo, is_printing);
+    else if (bench.runs) status = fib_bench(algo, index, &bench);
+    else fib_run(algo, is_set_algo, index, is_printing);
+
+    fib_cache_close();
+    pool_destroy(fib_pool);
+    if (fib_opts.is_mem_stats) mem_stats_report(stderr);
+    return status;
 }
 
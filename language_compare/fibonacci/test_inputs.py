@@ -166,4 +166,338 @@ class Testings(unittest.TestCase):
                 f'{cmd_stdout(f"{large_n} --algo adv")}'  # try to trigger an exception of integer string conversion (exceeding digits limit)
                 f'{cmd_stdout(f"{large_n} --algo straight")}'
                 large_n *= 10
-            
\ No newline at end of file
+
+    def test_surpass_any_index(self):  # the mixed-radix ladder must land exactly on n, not only on powers of 3
+        self.title("SURPASS MATCHES ADV")
+        test = tests['c']
+        def cmd_stdout(arguments):
+            return self.runcmd(f"{test} {arguments}").stdout
+
+        self.print_test_subject('c', 'every small index')
+        for i in range(1, algorithms_to_limits['straight']):
+            self.assertEqual(cmd_stdout(f"{i} --algo adv"), cmd_stdout(f"{i} --algo surpass"), msg=f"failed at index {i}")
+
+        self.print_test_subject('c', 'big indices')
+        for i in (3**12, 3**12 + 1, 2**20, 2 * 3**11, 10**5 + 7, algorithms_to_limits['adv']):
+            self.assertEqual(cmd_stdout(f"{i} --algo adv"), cmd_stdout(f"{i} --algo surpass"), msg=f"failed at index {i}")
+            
+    def test_prealloc_and_mem_stats(self):  # sizing buffers up front must not change results, and the report must stay off stdout
+        self.title("PREALLOCATED BUFFERS")
+        test = tests['c']
+
+        for algo in ('straight', 'adv', 'surpass'):
+            self.print_test_subject('c', f'{algo} with --prealloc')
+            for i in (1, 2, 3, 94, 1000, 12345, algorithms_to_limits['adv']):
+                regular = self.runcmd(f"{test} {i} --algo {algo}")
+                preallocated = self.runcmd(f"{test} {i} --algo {algo} --prealloc --mem-stats")
+                self.assertEqual(regular.stdout, preallocated.stdout, msg=f"failed at index {i}")
+                self.assertIn('reallocations: 0,', preallocated.stderr, msg=f"buffers regrew at index {i}")
+
+    def test_threads(self):  # splitting the products across threads must not change results
+        self.title("MULTI-THREADED MULTIPLICATION")
+        test = tests['c']
+
+        for algo in ('adv', 'surpass'):
+            self.print_test_subject('c', f'{algo} with --threads')
+            for i in (1, 12345, algorithms_to_limits['adv'], 3**13, 2 * algorithms_to_limits['adv'] + 1):
+                expected = self.runcmd(f"{test} {i} --algo {algo}").stdout
+                for threads in (2, 3, 8):
+                    self.assertEqual(expected, self.runcmd(f"{test} {i} --algo {algo} --threads {threads}").stdout, msg=f"failed at index {i} with {threads} threads")
+
+    def test_mul_backends(self):  # the NTT backend must agree with GMP on every instruction set it can pick
+        self.title("MULTIPLICATION BACKENDS")
+        test = tests['c']
+
+        for isa in ('scalar', 'sse4.2', 'avx2', 'avx512'):  # unsupported ones fall back to the best the CPU has
+            self.print_test_subject('c', f'--mul ntt on {isa}')
+            for i in (1, 12345, algorithms_to_limits['adv'], 3**14, 3 * algorithms_to_limits['adv'] + 1):
+                expected = self.runcmd(f"{test} {i} --algo surpass").stdout
+                for threads in (1, 3):
+                    result = self.runcmd(f"FIBO_NTT_ISA={isa} {test} {i} --algo surpass --mul ntt --threads {threads}").stdout
+                    self.assertEqual(expected, result, msg=f"failed at index {i} with {threads} threads")
+                self.assertEqual(expected, self.runcmd(f"FIBO_NTT_ISA={isa} {test} {i} --algo adv --mul ntt").stdout, msg=f"adv failed at index {i}")
+
+    def test_output_formats(self):  # the segmented decimal output, hex and raw must all describe the same number
+        self.title("OUTPUT FORMATS")
+        import base64, sys
+        test = tests['c']
+        sys.set_int_max_str_digits(0)
+
+        for i in (1, 2, 93, 94, 1000, 313000, algorithms_to_limits['adv'], 3 * algorithms_to_limits['adv'] + 1):
+            self.print_test_subject('c', f'formats at index {i}')
+            decimal = self.runcmd(f"{test} {i}").stdout
+            value = int(self.runcmd(f"{test} {i} --format hex").stdout, 16)
+            self.assertEqual(decimal, f"{value}\n", msg=f"hex disagrees at index {i}")
+            raw = base64.b64decode(self.runcmd(f"{test} {i} --format raw | base64 -w0").stdout)
+            self.assertEqual(value, int.from_bytes(raw, 'little'), msg=f"raw disagrees at index {i}")
+            for threads in (2, 5):
+                self.assertEqual(decimal, self.runcmd(f"{test} {i} --threads {threads}").stdout, msg=f"failed at index {i} with {threads} threads")
+
+    def test_cache(self):  # resuming from stored checkpoints must land on the same numbers, and a damaged cache must be ignored
+        self.title("CHECKPOINT CACHE")
+        import tempfile, os
+        test = tests['c']
+        indices = (1, 1000, 3**9, 3**10, 2**14, 3 * 2**14, 3**11 + 1, 2**15, 10**5 + 7, 3**12)
+
+        for algo in ('adv', 'surpass'):
+            with tempfile.TemporaryDirectory() as temp_dir:
+                cache = os.path.join(temp_dir, 'fibo.cache')
+                for attempt in ('filling', 'reading'):
+                    self.print_test_subject('c', f'{algo} {attempt} the cache')
+                    for i in indices:
+                        expected = self.runcmd(f"{test} {i} --algo {algo}").stdout
+                        self.assertEqual(expected, self.runcmd(f"{test} {i} --algo {algo} --cache {cache}").stdout, msg=f"failed at index {i}")
+                self.assertGreater(os.path.getsize(cache), 0)
+
+                self.print_test_subject('c', f'{algo} with a damaged cache')
+                with open(cache, 'r+b') as f:
+                    f.seek(os.path.getsize(cache) // 2)
+                    f.write(b'\xff\x00\xff\x00')
+                for i in indices:
+                    expected = self.runcmd(f"{test} {i} --algo {algo}").stdout
+                    self.assertEqual(expected, self.runcmd(f"{test} {i} --algo {algo} --cache {cache}").stdout, msg=f"failed at index {i}")
+
+        # batch ladders running side by side share one cache
+        with tempfile.TemporaryDirectory() as temp_dir:
+            cache = os.path.join(temp_dir, 'fibo.cache')
+            batch_input = '\n'.join(map(str, indices))
+            expected = self.runcmd(f"{test} --batch <<< '{batch_input}'").stdout
+            for attempt in ('filling', 'reading'):
+                self.print_test_subject('c', f'--batch --threads 4 {attempt} the cache')
+                self.assertEqual(expected, self.runcmd(f"{test} --batch --threads 4 --cache {cache} <<< '{batch_input}'").stdout)
+
+    def test_batch(self):  # one process answering many lines must print what separate runs print, in the order asked
+        self.title("BATCH MODE")
+        test = tests['c']
+        lines = ['12', '5 naive', '1', '3000 straight', '2', '', '999 surpass', '1000', '1001', '94 adv', '3 straight', str(3**11)]
+        lines += [str(i) for i in range(algorithms_to_limits['straight'], 0, -37)]
+        expected = ''
+        for line in lines:
+            if line:
+                index, *algo = line.split()
+                expected += self.runcmd(f"{test} {index} --algo {algo[0] if algo else 'adv'}").stdout
+
+        batch_input = '\n'.join(lines)
+        for extra in ('', '--threads 3', '--algo surpass', '--prealloc --threads 2'):
+            self.print_test_subject('c', f'--batch {extra}')
+            self.assertEqual(expected, self.runcmd(f"{test} --batch {extra} <<< '{batch_input}'").stdout)
+
+        # concurrent ladders big enough for the NTT, growing its twiddle tables while the others are reading them
+        self.print_test_subject('c', '--batch --threads 4 --mul ntt')
+        big = [str(i) for i in (600000, 1200001, 700003, 3**13, 900000, 2000000)]
+        expected = ''.join(self.runcmd(f"{test} {i} --mul gmp").stdout for i in big)
+        big_input = '\n'.join(big)
+        self.assertEqual(expected, self.runcmd(f"{test} --batch --threads 4 --mul ntt <<< '{big_input}'").stdout)
+
+        self.print_test_subject('c', 'rejected batch input')
+        for bad in ('0', '-4', '12 quick', '1 adv extra', 'x'):
+            self.assertNotEqual(self.runcmd(f"echo '{bad}' | {test} --batch").returncode, 0, msg=f"accepted '{bad}'")
+        self.assertNotEqual(self.runcmd(f"echo 5 | {test} 5 --batch").returncode, 0)
+
+    def test_more_engines(self):  # lucas, matrix and whatever auto picks must agree with adv
+        self.title("LUCAS, MATRIX AND AUTO ENGINES")
+        import tempfile, os
+        test = tests['c']
+        def cmd_stdout(arguments):
+            return self.runcmd(f"{test} {arguments}").stdout
+
+        for algo in ('lucas', 'matrix', 'auto'):
+            self.print_test_subject('c', f'{algo} against adv')
+            for i in list(range(1, 200)) + [1000, 1023, 1024, 12345, algorithms_to_limits['adv'], 3**13, 2**21 + 1]:
+                self.assertEqual(cmd_stdout(f"{i} --algo adv"), cmd_stdout(f"{i} --algo {algo}"), msg=f"failed at index {i}")
+            self.assertEqual(cmd_stdout(f"{3**13} --algo adv"), cmd_stdout(f"{3**13} --algo {algo} --threads 3 --prealloc"))
+
+        self.print_test_subject('c', 'auto with a config file')
+        with tempfile.TemporaryDirectory() as temp_dir:
+            config = os.path.join(temp_dir, 'fibo.conf')
+            with open(config, 'w') as f:
+                f.write("# comment\n1 matrix\n100 straight\n5000 surpass\n")
+            for i in (1, 99, 100, 4999, 5000, 77777):
+                self.assertEqual(cmd_stdout(f"{i} --algo adv"), cmd_stdout(f"{i} --algo auto --config {config}"), msg=f"failed at index {i}")
+            with open(config, 'w') as f:
+                f.write("5 matrix\n1 straight\n")  # must start at 1 and go up
+            result = self.runcmd(f"{test} 1000 --algo auto --config {config}")
+            self.assertEqual(cmd_stdout("1000 --algo adv"), result.stdout)
+            self.assertIn('malformed', result.stderr)
+
+    def test_small_index_paths(self):  # the u128 table and the stack ladder must match plain big-number additions on both sides of their limits
+        self.title("SMALL INDEX FAST PATHS")
+        import base64
+        test = tests['c']
+        fibs = [0, 1]
+        while len(fibs) <= 6000:
+            fibs.append(fibs[-1] + fibs[-2])
+
+        self.print_test_subject('c', 'decimal, hex and raw')
+        for i in list(range(1, 200)) + [500, 1000, 4096, 5889, 5890, 5891, 5892, 6000]:
+            self.assertEqual(f"{fibs[i]}\n", self.runcmd(f"{test} {i}").stdout, msg=f"failed at index {i}")
+            self.assertEqual(f"{fibs[i]:x}\n", self.runcmd(f"{test} {i} --format hex").stdout, msg=f"hex failed at index {i}")
+            raw = base64.b64decode(self.runcmd(f"{test} {i} --format raw | base64 -w0").stdout)
+            self.assertEqual(fibs[i], int.from_bytes(raw, 'little'), msg=f"raw failed at index {i}")
+
+        # the shortcuts are only for the default engine and auto; a named one must run itself, and be right
+        self.print_test_subject('c', 'named engines at small indices')
+        small = list(range(1, 200, 7)) + [186, 187, 1000, 5890, 5891]
+        for algo in ('straight', 'adv', 'surpass', 'lucas', 'matrix', 'lean'):
+            for i in small:
+                self.assertEqual(f"{fibs[i]}\n", self.runcmd(f"{test} {i} --algo {algo}").stdout, msg=f"{algo} failed at index {i}")
+            batch_input = '\n'.join(f"{i} {algo}" for i in small)
+            expected = ''.join(f"{fibs[i]}\n" for i in small)
+            self.assertEqual(expected, self.runcmd(f"{test} --batch <<< '{batch_input}'").stdout, msg=f"{algo} failed in batch")
+
+    def test_bench(self):  # --bench lines must be in the shape plot_results.py reads, with sane statistics
+        self.title("IN-PROCESS BENCHMARK")
+        import json
+        test = tests['c']
+
+        self.print_test_subject('c', 'json lines')
+        result = self.runcmd(f"{test} 1000 --bench 5 --warmup 1 --algo adv")
+        self.assertEqual(0, result.returncode)
+        stats = {}
+        for line in result.stdout.splitlines():
+            (label, samples), = json.loads(line).items()
+            stats[label] = [(int(n), float(sec)) for sample in samples for n, sec in sample.items()]
+        self.assertEqual(['C_adv_min', 'C_adv_median', 'C_adv_p95'], list(stats))
+        for label, samples in stats.items():
+            self.assertEqual([3**k for k in range(7)], [n for n, _ in samples], msg=label)
+        for low, mid, high in zip(stats['C_adv_min'], stats['C_adv_median'], stats['C_adv_p95']):
+            self.assertTrue(0 <= low[1] <= mid[1] <= high[1], msg=f"unordered statistics at index {low[0]}")
+
+        self.print_test_subject('c', 'perf counters or a warning')
+        result = self.runcmd(f"{test} 100 --bench 2 --algo lucas --perf")
+        self.assertEqual(0, result.returncode)
+        self.assertTrue('C_lucas_cycles' in result.stdout or 'perf_event_open' in result.stderr)
+
+        self.print_test_subject('c', 'bad arguments')
+        for arguments in ("100 --bench 0", "--bench 3", "100 --perf", "100 --bench 3 --batch", "100 --bench 2 --bench 3"):
+            self.assertNotEqual(0, self.runcmd(f"{test} {arguments}").returncode, msg=arguments)
+
+    def test_mod(self):  # F(n) mod M against Python's big integers, on every arithmetic path (Montgomery, wrap-around + CRT, Barrett)
+        self.title("MODULAR MODE")
+        test = tests['c']
+        def fib_mod(n, m):
+            a, b = 0, 1
+            for bit in bin(n)[2:]:
+                a, b = a * (2*b - a) % m, (a*a + b*b) % m
+                if bit == '1': a, b = b, (a + b) % m
+            return a
+
+        moduli = [1, 2, 7, 10, 1000000007, 2**61 - 1, 2**63, 3 * 2**40, 2**64 - 1, 2**64 - 59,  # word-sized
+                  2**64, 10**30, 2**127 - 1, 3**100, 1000000007 * (2**89 - 1), 2**200 + 1]     # multi-limb
+        indices = [1, 2, 3, 5, 100, 186, 1000, 2**64 + 1, 12345678901234567890123, 10**1000, 3**2000 + 7]
+        self.print_test_subject('c', 'against python')
+        for m in moduli:
+            for n in indices:
+                self.assertEqual(f"{fib_mod(n, m)}\n", self.runcmd(f"{test} {n} --mod {m}").stdout, msg=f"failed at F({n}) mod {m}")
+        self.assertEqual(f"{fib_mod(10**50, 10**40):x}\n", self.runcmd(f"{test} {10**50} --mod {10**40} --format hex").stdout)
+
+        self.print_test_subject('c', 'bad arguments')
+        for arguments in ("0 --mod 5", "5 --mod 0", "5 --mod -3", "1e9 --mod 5", "--mod 5", "5 --mod 3 --algo adv", "5 --mod 3 --mod 4"):
+            self.assertNotEqual(0, self.runcmd(f"{test} {arguments}").returncode, msg=arguments)
+
+    def test_digits_and_leading(self):  # the Binet estimates must give exactly the digits of the full number
+        self.title("DIGIT COUNT AND LEADING DIGITS")
+        import random, sys
+        sys.set_int_max_str_digits(0)
+        test = tests['c']
+        fibs = [0, 1]
+        while len(fibs) <= 30000:
+            fibs.append(fibs[-1] + fibs[-2])
+
+        self.print_test_subject('c', 'against python')
+        random.seed(12)
+        for n in list(range(1, 200, 7)) + random.sample(range(200, 30001), 60):
+            digits = str(fibs[n])
+            for k in sorted({1, 17, len(digits) - 1, len(digits), len(digits) + 5} - {0}):
+                result = self.runcmd(f"{test} {n} --digits --leading {k}")
+                self.assertEqual(f"{len(digits)}\n{digits[:k]}\n", result.stdout, msg=f"failed at index {n}, K={k}")
+        self.assertEqual(f"{len(str(fibs[12345]))}\n", self.runcmd(f"{test} 12345 --digits").stdout)
+
+        self.print_test_subject('c', 'far beyond memory')  # F(10^12) has ~7*10^11 bits; only the estimate can answer this
+        self.assertEqual("208987640250\n4258422688995883588634833\n", self.runcmd(f"{test} 1000000000000 --digits --leading 25").stdout)
+
+        self.print_test_subject('c', 'bad arguments')
+        for arguments in ("100 --leading 0", "100 --leading -3", "--digits", "100 --digits --format hex", "100 --digits --mod 7"):
+            self.assertNotEqual(0, self.runcmd(f"{test} {arguments}").returncode, msg=arguments)
+
+    def test_range(self):  # every line of a range must be the right value, in order, whatever the formatter count
+        self.title("RANGE MODE")
+        import sys
+        sys.set_int_max_str_digits(0)
+        test = tests['c']
+        fibs = [0, 1]
+        while len(fibs) <= 20000:
+            fibs.append(fibs[-1] + fibs[-2])
+
+        self.print_test_subject('c', 'against python')
+        for first, last in ((1, 1), (1, 300), (186, 190), (1000, 1000), (4095, 4200), (15000, 20000)):
+            expected = ''.join(f"{fibs[i]}\n" for i in range(first, last + 1))
+            for threads in (1, 3):
+                self.assertEqual(expected, self.runcmd(f"{test} --range {first}:{last} --threads {threads}").stdout, msg=f"failed at {first}:{last}")
+        self.assertEqual(''.join(f"{fibs[i]:x}\n" for i in range(100, 5001)), self.runcmd(f"{test} --range 100:5000 --format hex --threads 2").stdout)
+        self.assertEqual('', self.runcmd(f"{test} --range 1:5000 -n").stdout)
+
+        self.print_test_subject('c', 'bad arguments')
+        for arguments in ("--range 0:5", "--range 5:3", "--range 5", "--range :5", "--range 1:x", "--range 1:5 --format raw", "10 --range 1:5"):
+            self.assertNotEqual(0, self.runcmd(f"{test} {arguments}").returncode, msg=arguments)
+
+    def test_out_of_core(self):  # lean must agree with adv, and scratch-file blocks must not change a single digit
+        self.title("OUT-OF-CORE MODE")
+        import tempfile, os
+        test = tests['c']
+        def cmd_stdout(arguments):
+            return self.runcmd(f"{test} {arguments}").stdout
+
+        self.print_test_subject('c', 'lean against adv')
+        for i in list(range(1, 300)) + [1023, 1024, 1025, 12345, algorithms_to_limits['adv'], 3**13]:
+            self.assertEqual(cmd_stdout(f"{i} --algo adv"), cmd_stdout(f"{i} --algo lean"), msg=f"failed at index {i}")
+
+        self.print_test_subject('c', 'scratch files')
+        with tempfile.TemporaryDirectory() as scratch:
+            large_n = 2 * 10**7 + 1  # big enough for the products to pass the 1MiB threshold
+            expected = cmd_stdout(f"{large_n} --format hex")
+            for arguments in ("", "--algo adv", "--mul ntt --threads 3"):
+                result = self.runcmd(f"{test} {large_n} --format hex --mem-limit 2M --scratch {scratch} --mem-stats {arguments}")
+                self.assertEqual(expected, result.stdout, msg=arguments)
+                self.assertRegex(result.stderr, r"blocks in scratch files: [1-9]")
+            self.assertEqual([], os.listdir(scratch))  # unlinked from the start
+
+        self.print_test_subject('c', 'progress')
+        result = self.runcmd(f"{test} 1000000 -n --algo lean --progress")
+        self.assertEqual(20, len(result.stderr.splitlines()))  # one line per bit of n
+        self.assertIn("step 20/20: F(1000000)", result.stderr)
+
+        self.print_test_subject('c', 'bad arguments')
+        for arguments in ("100 --mem-limit 0", "100 --mem-limit 5X", "100 --mem-limit -5M", "100 --scratch /tmp", "100 --progress", "100 --algo adv --progress"):
+            self.assertNotEqual(0, self.runcmd(f"{test} {arguments}").returncode, msg=arguments)
+
+    def test_trace_build(self):  # a -DFIB_TRACE build must give the same results, and one well-formed record per ladder step
+        self.title("STEP TRACING BUILD")
+        import tempfile, os, json, shutil
+        if not shutil.which('gcc'):
+            self.skipTest("no gcc to build the tracing binary with")
+        source = f"{this_files_dir}/fibo_c.c"
+        with tempfile.TemporaryDirectory() as temp_dir:
+            traced = os.path.join(temp_dir, 'fibo_c_trace.bin')
+            build = self.runcmd(f"gcc -O2 -m64 -pthread -DFIB_TRACE {source} -lgmp -o {traced}")
+            self.assertEqual(0, build.returncode, msg=build.stderr)
+
+            self.print_test_subject('c', 'chrome trace json')
+            trace_path = os.path.join(temp_dir, 'trace.json')
+            n = 1000000
+            self.assertEqual(self.runcmd(f"{tests['c']} {n}").stdout, self.runcmd(f"FIBO_TRACE={trace_path} {traced} {n}").stdout)
+            with open(trace_path) as f:
+                events = json.load(f)['traceEvents']
+            self.assertEqual(n.bit_length(), len(events))  # adv: one doubling per bit
+            self.assertEqual(n, events[-1]['args']['k'])
+            self.assertTrue(all(e['ph'] == 'X' and e['dur'] >= 0 and e['name'] == 'double' for e in events))
+            self.assertEqual('basecase', events[0]['args']['mul'])
+
+            self.print_test_subject('c', 'csv')
+            trace_path = os.path.join(temp_dir, 'trace.csv')
+            self.runcmd(f"FIBO_TRACE={trace_path} {traced} {3**12 + 5} -n --algo surpass")
+            with open(trace_path) as f:
+                header, *rows = f.read().splitlines()
+            self.assertTrue(header.startswith("step,k,start_ns,duration_ns,cycles,limbs_k,limbs_k1,mul"))
+            self.assertTrue(rows and all(len(row.split(',')) == len(header.split(',')) for row in rows))
+            self.assertEqual(str(3**12 + 5), rows[-1].split(',')[1])
@@ -0,0 +1,146 @@
+// Fast-access and item-history-preserving array, the C++ take on HistoryArray.py. Header-only, C++20.
+//
+// HistoryArray.py keeps a list per slot and rebuilds its whole snapshot on the first read after any push/pop. Here the
+// snapshot *is* the storage: current values sit in one contiguous array, updated in place, so a push/pop costs O(1) and
+// reading the snapshot costs nothing (get_array() is a std::span over it, no copy).
+// The older values live in one shared log instead of a container per slot. A push moves the slot's current value into a
+// log entry linked to the slot's previous entry; a pop moves it back and puts the entry on a free list for the next push.
+// The log grows in fixed-size chunks, so entries never move and growing never copies the history. (Chunks are allocated
+// whole, so T has to be default-constructible, as well as movable.)
+//
+//   HistoryArray<int> h({10, 20, 30});
+//   h.push(0, 15);            // h.get_array() == {15, 20, 30}
+//   h.pop(0);                 // back to {10, 20, 30}
+//   h.push_batch(indices, values);
+//
+// Errors mirror the Python version: out-of-range indices throw std::out_of_range (IndexError there), popping a slot's only
+// value throws std::logic_error (ValueError there).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+template <typename T, typename Index = std::uint32_t>  // Index numbers the log entries; 32 bits keeps an entry of int at 8 bytes
+class HistoryArray
+{
+    static_assert(!std::is_same_v<T, bool>, "std::vector<bool> isn't contiguous, use char or std::uint8_t");
+    static_assert(std::is_unsigned_v<Index>);
+
+    static constexpr Index NONE = std::numeric_limits<Index>::max();  // no older value (or the end of the free list)
+    static constexpr std::size_t CHUNK_BITS = 12;                       // 4096 entries per log chunk
+    static constexpr std::size_t CHUNK_SIZE = std::size_t{1} << CHUNK_BITS;
+
+    struct Entry
+    {
+        T value;
+        Index parent;  // the slot's next older entry, or the next free one
+    };
+
+    std::vector<T> current;                         // the snapshot
+    std::vector<Index> top;                         // per slot: newest log entry, NONE if the slot has a single value
+    std::vector<Index> depth;                       // per slot: how many pops are available
+    std::vector<std::unique_ptr<Entry[]>> chunks;   // the log
+    std::size_t log_size = 0;                       // entries ever handed out (used or free)
+    Index free_head = NONE;
+
+    Entry &entry(Index i) { return chunks[i >> CHUNK_BITS][i & (CHUNK_SIZE - 1)]; }
+
+    void check_index(std::size_t index) const
+    {
+        if (index >= current.size()) throw std::out_of_range("Index out of range");
+    }
+
+    Index new_entry()
+    {
+        if (free_head != NONE)
+        {
+            Index i = free_head;
+            free_head = entry(i).parent;
+            return i;
+        }
+        if (log_size == static_cast<std::size_t>(NONE)) throw std::length_error("HistoryArray log is full, use a wider Index");
+        if (log_size == chunks.size() * CHUNK_SIZE) chunks.push_back(std::make_unique<Entry[]>(CHUNK_SIZE));
+        return static_cast<Index>(log_size++);
+    }
+
+    void push_unchecked(std::size_t index, T value)
+    {
+        Index i = new_entry();
+        entry(i) = Entry{std::move(current[index]), top[index]};
+        top[index] = i;
+        depth[index]++;
+        current[index] = std::move(value);
+    }
+
+public:
+    HistoryArray(std::initializer_list<T> initial_items) : HistoryArray(std::vector<T>(initial_items)) {}
+
+    explicit HistoryArray(std::vector<T> initial_items)
+        : current(std::move(initial_items)), top(current.size(), NONE), depth(current.size(), 0) {}
+
+    std::size_t size() const { return current.size(); }
+
+    // Push a value to the slot at the given index; the old one becomes history.
+    void push(std::size_t index, T value)
+    {
+        check_index(index);
+        push_unchecked(index, std::move(value));
+    }
+
+    // Push values[i] to slot indices[i] for every i, in order (a slot may repeat). All indices are checked first, so
+    // a bad one throws before anything changed.
+    void push_batch(std::span<const std::size_t> indices, std::span<const T> values)
+    {
+        if (indices.size() != values.size()) throw std::invalid_argument("push_batch needs as many values as indices");
+        for (std::size_t index : indices) check_index(index);
+        for (std::size_t i = 0; i < indices.size(); i++) push_unchecked(indices[i], values[i]);
+    }
+
+    // Bring back the slot's previous value.
+    void pop(std::size_t index)
+    {
+        check_index(index);
+        if (top[index] == NONE) throw std::logic_error("Cannot pop the only remaining item at index " + std::to_string(index));
+        Index i = top[index];
+        Entry &e = entry(i);
+        current[index] = std::move(e.value);
+        top[index] = e.parent;
+        depth[index]--;
+        e.parent = free_head;
+        free_head = i;
+    }
+
+    // how many pops the slot has left
+    std::size_t history_depth(std::size_t index) const
+    {
+        check_index(index);
+        return depth[index];
+    }
+
+    // The current value of every slot. Zero-copy: a view of the live values, so later pushes/pops show through it.
+    std::span<const T> get_array() const { return current; }
+
+    // The current value at the given index.
+    const T &operator[](std::size_t index) const
+    {
+        check_index(index);
+        return current[index];
+    }
+
+    // Room for this many pushes in the log before it needs another chunk.
+    void reserve_history(std::size_t entries)
+    {
+        while (chunks.size() * CHUNK_SIZE < entries) chunks.push_back(std::make_unique<Entry[]>(CHUNK_SIZE));
+    }
+};
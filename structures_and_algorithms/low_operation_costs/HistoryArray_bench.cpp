@@ -0,0 +1,128 @@
+// Runs HistoryArray.hpp through the workload HistoryArray_bench.py gives the Python version, use like so:
+//   <this binary> <cells> <ops> <skew> <read_every> <seed>   ->  prints "<seconds> <checksum>"
+//   <this binary> test                                      ->  the checks TestHistoryArray does on the Python one
+// Build: g++ -O2 -std=c++20 HistoryArray_bench.cpp -o HistoryArray_bench  (HistoryArray_bench.py does this itself)
+
+#include "HistoryArray.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+
+// splitmix64, same as in HistoryArray_bench.py, so both sides see the same operations
+static std::uint64_t next_random(std::uint64_t &state)
+{
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Every op picks a cell as cells * u^skew for a uniform u (skew 1 is uniform, higher piles the ops onto the first cells),
+// then pops it (1 in 4, when it has history) or pushes a new value to it. Every read_every ops the snapshot is read.
+static std::uint64_t run_workload(std::size_t cells, std::size_t ops, double skew, std::size_t read_every, std::uint64_t seed)
+{
+    std::vector<std::uint64_t> initial(cells);
+    for (std::size_t i = 0; i < cells; i++) initial[i] = i % 1000;
+    HistoryArray<std::uint64_t> h(std::move(initial));
+
+    std::uint64_t state = seed, checksum = 0;
+    for (std::size_t op = 1; op <= ops; op++)
+    {
+        double u = static_cast<double>(next_random(state) >> 11) * 0x1p-53;
+        std::size_t index = static_cast<std::size_t>(static_cast<double>(cells) * std::pow(u, skew));
+        if (index >= cells) index = cells - 1;
+        std::uint64_t r = next_random(state);
+        if ((r & 3) == 0 && h.history_depth(index) > 0) h.pop(index);
+        else h.push(index, r >> 40);
+        if (op % read_every == 0) checksum = checksum * 31 + h.get_array()[index];
+    }
+    for (std::uint64_t value : h.get_array()) checksum += value;
+    return checksum;
+}
+
+#define CHECK(condition) do { if (!(condition)) { std::fprintf(stderr, "check failed at line %d: %s\n", __LINE__, #condition); return 1; } } while (0)
+#define CHECK_THROWS(exception, statement) do { bool is_thrown = false; try { statement; } catch (const exception &) { is_thrown = true; } CHECK(is_thrown); } while (0)
+
+static bool equals(std::span<const int> got, std::vector<int> expected) { return std::equal(got.begin(), got.end(), expected.begin(), expected.end()); }
+
+static int run_tests()
+{
+    {  // test_array_initial
+        HistoryArray<int> h({10, 20, 30});
+        CHECK(equals(h.get_array(), {10, 20, 30}));
+        CHECK(equals(h.get_array(), {10, 20, 30}));  // once more to be sure
+    }
+    {  // test_push_pop
+        HistoryArray<int> h({10, 20, 30});
+        h.push(0, 15);
+        CHECK(equals(h.get_array(), {15, 20, 30}));
+        h.push(0, 100);
+        CHECK(equals(h.get_array(), {100, 20, 30}));
+        h.pop(0);
+        h.pop(0);
+        CHECK(equals(h.get_array(), {10, 20, 30}));
+        CHECK(h.history_depth(0) == 0);
+    }
+    {  // test_get
+        HistoryArray<int> h({10, 20, 30});
+        CHECK(h[0] == 10);
+        h.push(2, 100);
+        CHECK(h[2] == 100);
+    }
+    {  // errors: popping the only value, out-of-range indices (no negative ones with size_t)
+        HistoryArray<int> h({10, 20, 30});
+        CHECK_THROWS(std::logic_error, h.pop(0));
+        CHECK_THROWS(std::out_of_range, h.push(3, 40));
+        CHECK_THROWS(std::out_of_range, h.pop(3));
+        CHECK_THROWS(std::out_of_range, (void)h[3]);
+    }
+    {  // batches, and the free list handing popped entries to the next pushes
+        HistoryArray<int> h({1, 2, 3});
+        std::vector<std::size_t> indices = {0, 2, 0};
+        std::vector<int> values = {7, 8, 9};
+        h.push_batch(indices, values);
+        CHECK(equals(h.get_array(), {9, 2, 8}));
+        std::vector<std::size_t> bad_indices = {1, 5, 1};
+        CHECK_THROWS(std::out_of_range, h.push_batch(bad_indices, values));
+        CHECK(equals(h.get_array(), {9, 2, 8}));  // nothing applied
+        for (int round = 0; round < 3; round++)
+        {
+            for (int i = 0; i < 10000; i++) h.push(1, i);
+            for (int i = 0; i < 10000; i++) h.pop(1);
+        }
+        CHECK(equals(h.get_array(), {9, 2, 8}));
+        h.pop(0);
+        CHECK(equals(h.get_array(), {7, 2, 8}));
+    }
+    std::printf("OK\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && std::strcmp(argv[1], "test") == 0) return run_tests();
+    if (argc != 6)
+    {
+        std::fprintf(stderr, "Usage: %s <cells> <ops> <skew> <read_every> <seed>  |  %s test\n", argv[0], argv[0]);
+        return 1;
+    }
+    std::size_t cells = std::strtoull(argv[1], nullptr, 10), ops = std::strtoull(argv[2], nullptr, 10);
+    double skew = std::strtod(argv[3], nullptr);
+    std::size_t read_every = std::strtoull(argv[4], nullptr, 10);
+    std::uint64_t seed = std::strtoull(argv[5], nullptr, 10);
+    if (cells == 0 || read_every == 0 || skew <= 0) return std::fprintf(stderr, "cells, read_every and skew must be positive\n"), 1;
+
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t checksum = run_workload(cells, ops, skew, read_every, seed);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%.6f %llu\n", elapsed.count(), static_cast<unsigned long long>(checksum));
+    return 0;
+}
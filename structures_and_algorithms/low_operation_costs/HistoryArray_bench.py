@@ -0,0 +1,83 @@
+#!/usr/bin/python3
+
+"""Times HistoryArray.py against HistoryArray.hpp on the same random workloads, use like so: <this file> [cells ops skew read_every]"""
+""" Both sides replay the same operations (same splitmix64 stream): every op picks a cell as cells * u^skew (skew 1 is uniform,
+    higher piles the ops onto the first cells), then pops it (1 in 4, when it has history) or pushes a new value to it.
+    Every read_every ops the snapshot is read - where the Python version pays its O(cells) rebuild.
+    The C++ side is built with g++ (-O2 -std=c++20) from HistoryArray_bench.cpp, and its unit checks run first.
+    The checksums have to agree, or the run is reported as a mismatch.
+"""
+
+import sys
+import time
+import subprocess
+import tempfile
+from pathlib import Path
+
+from HistoryArray import HistoryArray
+
+this_files_dir = Path(__file__).resolve().parent
+
+MASK64 = (1 << 64) - 1
+
+SCENARIOS = (  # (cells, ops, skew, read_every, label)
+    (1_000_000, 100_000, 1.0, 1000, "1M cells, uniform"),
+    (1_000_000, 100_000, 8.0, 1000, "1M cells, skewed (half the ops on the first 0.4%)"),
+    (10_000, 100_000, 1.0, 10, "10K cells, read every 10 ops"),
+    (10_000, 100_000, 8.0, 10, "10K cells, skewed, read every 10 ops"),
+)
+
+
+def next_random(state):
+    """splitmix64, same as in HistoryArray_bench.cpp. Returns (new state, output)."""
+    state = (state + 0x9E3779B97F4A7C15) & MASK64
+    z = state
+    z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & MASK64
+    z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & MASK64
+    return state, z ^ (z >> 31)
+
+def run_python(cells, ops, skew, read_every, seed):
+    h = HistoryArray(i % 1000 for i in range(cells))
+    state, checksum = seed, 0
+    start = time.perf_counter()
+    for op in range(1, ops + 1):
+        state, r = next_random(state)
+        index = min(int(cells * ((r >> 11) * 2.0**-53) ** skew), cells - 1)
+        state, r = next_random(state)
+        if (r & 3) == 0 and len(h.array[index]) > 1:
+            h.pop(index)
+        else:
+            h.push(index, r >> 40)
+        if op % read_every == 0:
+            checksum = (checksum * 31 + h.get_array()[index]) & MASK64
+    checksum = (checksum + sum(h.get_array())) & MASK64
+    return time.perf_counter() - start, checksum
+
+def build_cpp(out_dir):
+    binary = Path(out_dir) / "HistoryArray_bench"
+    subprocess.run(["g++", "-O2", "-std=c++20", str(this_files_dir / "HistoryArray_bench.cpp"), "-o", str(binary)], check=True)
+    subprocess.run([str(binary), "test"], check=True, stdout=subprocess.DEVNULL)
+    return binary
+
+def run_cpp(binary, cells, ops, skew, read_every, seed):
+    seconds, checksum = subprocess.run([str(binary), str(cells), str(ops), str(skew), str(read_every), str(seed)],
+                                       check=True, capture_output=True, text=True).stdout.split()
+    return float(seconds), int(checksum)
+
+
+if __name__ == "__main__":
+    scenarios = SCENARIOS
+    if len(sys.argv) == 5:
+        scenarios = ((int(sys.argv[1]), int(sys.argv[2]), float(sys.argv[3]), int(sys.argv[4]), "custom"),)
+    elif len(sys.argv) != 1:
+        print(f"Usage: {sys.argv[0]} [cells ops skew read_every]")
+        exit(1)
+
+    with tempfile.TemporaryDirectory() as build_dir:
+        binary = build_cpp(build_dir)
+        print(f"{'scenario':<50} {'python (s)':>11} {'c++ (s)':>9} {'speedup':>9}")
+        for cells, ops, skew, read_every, label in scenarios:
+            py_time, py_sum = run_python(cells, ops, skew, read_every, seed=1)
+            cpp_time, cpp_sum = run_cpp(binary, cells, ops, skew, read_every, seed=1)
+            result = f"{py_time / cpp_time:8.0f}x" if py_sum == cpp_sum else " MISMATCH"
+            print(f"{label:<50} {py_time:11.3f} {cpp_time:9.4f} {result}")
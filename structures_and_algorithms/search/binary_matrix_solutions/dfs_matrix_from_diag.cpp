@@ -0,0 +1,362 @@
+// Native take on dfs_matrix_from_diag.py: finds the 0/1 matrices with the given row and column sums, use like so:
+//   <this binary> 3 1 1 1 2 2 [--all] [--count] [--threads N]
+//   <this binary> test                          ->  the counts TestAlgorithms.test_result_count expects
+// Build: g++ -O2 -std=c++20 -pthread dfs_matrix_from_diag.cpp -o dfs_matrix_from_diag
+//
+// Same input and same solutions as solve() there (upper-triangular with a diagonal of 1's, or any placement with --all),
+// but searched differently:
+//   - Row by row instead of cell by cell. A row's candidate columns are one 64-bit mask (allowed & still-needed), and its
+//     picks are the popcount-sized subsets of it, walked lowest bit first with ctz.
+//   - Feasibility bounds on both sides, one popcount each: a column can't need more 1's than the rows left could give it
+//     (needing exactly that many forces it into the current row), and a row can't need more than the columns still
+//     open to it. The rows are only rechecked when a pick closes a column. The sums as a whole go through the
+//     Gale-Ryser test once, up front; checking it at every step cost more than the subtrees it cut (the triangle leaves
+//     most of the full bipartite graph unusable, so it's a loose bound there).
+//   - Subtrees are shared between threads with work stealing: each worker has a deque, works LIFO off its own end and
+//     steals FIFO (the biggest subtrees) off the others'. A worker only splits off a subtree while someone is idle.
+// Solutions stream out as they're found (in numpy's print format); with more than one thread their order varies.
+// Limited to 64 rows and 64 columns, a bitset each.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static constexpr int MAX_SIZE = 64;
+
+struct Task  // a subtree: rows before `row` are filled in
+{
+    int row = 0;
+    std::array<std::uint8_t, MAX_SIZE> col_left{};   // 1's every column still needs
+    std::uint64_t open = 0;                           // columns with col_left > 0
+    std::array<std::uint64_t, MAX_SIZE> picked{};    // per filled row: the columns it got
+};
+
+struct WorkerQueue
+{
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::atomic<int> size{0};
+    std::uint64_t count = 0;  // solutions this worker found
+};
+
+class Solver
+{
+    int rows = 0, cols = 0;
+    bool is_upper = true, is_printing = false;
+    std::vector<int> row_sum;
+    std::array<std::uint64_t, MAX_SIZE> row_allowed{};  // per row: columns it may hold a 1 in
+    std::array<std::uint64_t, MAX_SIZE> col_allowed{};  // per column: rows that may hold a 1 in it
+    Task root;
+    bool is_impossible = false;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::atomic<long> pending{0};  // tasks queued or running
+    std::atomic<int> idle{0};      // workers looking for work
+    std::mutex print_lock;
+
+    // how many of rows i.. could still put a 1 in column j
+    int capacity(int i, int j) const { return std::popcount(col_allowed[j] >> i); }
+
+    // every row from `from` on still has enough open columns for its sum
+    bool rows_fit(std::uint64_t open, int from) const
+    {
+        for (int k = from; k < rows; k++)
+            if (std::popcount(row_allowed[k] & open) < row_sum[k]) return false;
+        return true;
+    }
+
+    // Gale-Ryser: the k largest row sums must fit into sum_j min(col_sum[j], k), for every k
+    bool is_gale_ryser(const std::vector<int> &col_sum) const
+    {
+        std::vector<int> sorted = row_sum;
+        std::sort(sorted.rbegin(), sorted.rend());
+        int need = 0;
+        for (int k = 1; k <= rows; k++)
+        {
+            need += sorted[k - 1];
+            int fits = 0;
+            for (int sum : col_sum) fits += std::min(sum, k);
+            if (need > fits) return false;
+        }
+        return true;
+    }
+
+    void found(WorkerQueue &w, const Task &t)
+    {
+        w.count++;
+        if (!is_printing) return;
+        std::string text;
+        for (int i = 0; i < rows; i++)
+        {
+            std::uint64_t line = t.picked[i] | (is_upper && i < cols ? std::uint64_t{1} << i : 0);
+            text += i == 0 ? "[[" : " [";
+            for (int j = 0; j < cols; j++)
+            {
+                text += (line >> j & 1) ? '1' : '0';
+                text += j + 1 < cols ? " " : "]";
+            }
+            text += i + 1 < rows ? "\n" : "]\n\n";
+        }
+        std::lock_guard<std::mutex> guard(print_lock);
+        std::fwrite(text.data(), 1, text.size(), stdout);
+    }
+
+    void search(WorkerQueue &w, Task &t)
+    {
+        int i = t.row;
+        if (i == rows)  // every row took exactly its sum and the totals matched, so every column is done too
+        {
+            found(w, t);
+            return;
+        }
+
+        std::uint64_t forced = 0, optional = 0;
+        for (std::uint64_t bits = row_allowed[i] & t.open; bits; bits &= bits - 1)
+        {
+            int j = std::countr_zero(bits);
+            (t.col_left[j] == capacity(i, j) ? forced : optional) |= std::uint64_t{1} << j;
+        }
+        int choose = row_sum[i] - std::popcount(forced);
+        if (choose < 0 || std::popcount(optional) < choose) return;
+        pick(w, t, optional, choose, forced);
+    }
+
+    // every way to add `choose` more columns out of `optional` to row t.row
+    void pick(WorkerQueue &w, Task &t, std::uint64_t optional, int choose, std::uint64_t chosen)
+    {
+        if (choose == 0)
+        {
+            descend(w, t, chosen);
+            return;
+        }
+        if (std::popcount(optional) < choose) return;
+        std::uint64_t low = optional & -optional;
+        pick(w, t, optional ^ low, choose - 1, chosen | low);
+        pick(w, t, optional ^ low, choose, chosen);
+    }
+
+    void descend(WorkerQueue &w, Task &t, std::uint64_t chosen)
+    {
+        int i = t.row;
+        std::uint64_t closed = 0;
+        for (std::uint64_t bits = chosen; bits; bits &= bits - 1)
+        {
+            int j = std::countr_zero(bits);
+            if (--t.col_left[j] == 0) closed |= std::uint64_t{1} << j;
+        }
+        t.open &= ~closed;
+        t.picked[i] = chosen;
+        t.row = i + 1;
+        if (!closed || rows_fit(t.open, t.row))  // else a row below lost too many columns
+        {
+            // hand the subtree out instead when another worker is starving. Only from the upper half: deeper subtrees
+            // are too small to be worth the steal, the thief would be back for more right away
+            if (idle.load(std::memory_order_relaxed) > 0 && t.row <= rows / 2 && w.size.load(std::memory_order_relaxed) < 2)
+            {
+                pending.fetch_add(1);
+                std::lock_guard<std::mutex> guard(w.lock);
+                w.tasks.push_back(t);
+                w.size.fetch_add(1, std::memory_order_relaxed);
+            }
+            else search(w, t);
+        }
+        t.row = i;
+        t.picked[i] = 0;
+        t.open |= closed;
+        for (std::uint64_t bits = chosen; bits; bits &= bits - 1) t.col_left[std::countr_zero(bits)]++;
+    }
+
+    bool take(WorkerQueue &q, Task &t, bool is_own)
+    {
+        if (q.size.load(std::memory_order_relaxed) == 0) return false;
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty()) return false;
+        if (is_own) { t = q.tasks.back(); q.tasks.pop_back(); }
+        else { t = q.tasks.front(); q.tasks.pop_front(); }
+        q.size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void work(std::size_t me)
+    {
+        WorkerQueue &own = *queues[me];
+        Task t;
+        bool is_idle = false;
+        int misses = 0;
+        std::uint64_t victim = me;
+        while (true)
+        {
+            bool is_found = take(own, t, true);
+            for (std::size_t tries = 0; !is_found && tries < queues.size(); tries++)
+            {
+                victim = victim * 6364136223846793005ull + 1442695040888963407ull;
+                std::size_t other = (victim >> 33) % queues.size();
+                if (other != me) is_found = take(*queues[other], t, false);
+            }
+            if (is_found)
+            {
+                if (is_idle) { idle.fetch_sub(1); is_idle = false; }
+                misses = 0;
+                search(own, t);
+                pending.fetch_sub(1);
+                continue;
+            }
+            if (pending.load() == 0) break;
+            if (!is_idle) { idle.fetch_add(1); is_idle = true; }
+            // spin a little (work usually shows up soon), then back off so waiting doesn't eat a busy worker's core
+            if (++misses < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (is_idle) idle.fetch_sub(1);
+    }
+
+public:
+    // Same sums as solve(): the first half of diag are row sums, the rest column sums, less the diagonal's 1 if is_upper.
+    Solver(const std::vector<int> &diag, bool is_upper, bool is_printing) : is_upper(is_upper), is_printing(is_printing)
+    {
+        rows = static_cast<int>(diag.size() / 2);
+        cols = static_cast<int>(diag.size()) - rows;
+        if (rows > MAX_SIZE || cols > MAX_SIZE) throw std::invalid_argument("at most 64 rows and 64 columns");
+        int offset = is_upper ? 1 : 0;
+        long row_total = 0, col_total = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            row_sum.push_back(diag[i] - offset);
+            row_total += row_sum.back();
+            is_impossible |= row_sum.back() < 0;
+        }
+        std::vector<int> col_sum;
+        for (int j = 0; j < cols; j++)
+        {
+            col_sum.push_back(diag[rows + j] - offset);
+            col_total += col_sum.back();
+            is_impossible |= col_sum.back() < 0 || col_sum.back() > MAX_SIZE;
+            root.col_left[j] = static_cast<std::uint8_t>(std::clamp(col_sum.back(), 0, MAX_SIZE));
+            if (root.col_left[j]) root.open |= std::uint64_t{1} << j;
+        }
+        is_impossible |= row_total != col_total;
+
+        // solve() also lets row 0 take column 0 (its scan starts at past_col+1 = 0), which only matters for sums no
+        // upper-triangular matrix has; here the upper part is strictly above the diagonal
+        for (int i = 0; i < rows; i++)
+            for (int j = is_upper ? i + 1 : 0; j < cols; j++)
+            {
+                row_allowed[i] |= std::uint64_t{1} << j;
+                col_allowed[j] |= std::uint64_t{1} << i;
+            }
+        for (int j = 0; j < cols; j++) is_impossible |= root.col_left[j] > capacity(0, j);  // forcing keeps this true below
+        is_impossible = is_impossible || !rows_fit(root.open, 0) || !is_gale_ryser(col_sum);
+    }
+
+    // Counts every solution (printing each, if asked). Unlike solve(), all-zero sums count their single (empty) solution;
+    // solve() only checks for a solution after its first pick, so it finds none there.
+    std::uint64_t run(unsigned threads)
+    {
+        if (is_impossible) return 0;
+        threads = std::max(1u, threads);
+        queues.clear();
+        for (unsigned k = 0; k < threads; k++) queues.push_back(std::make_unique<WorkerQueue>());
+        queues[0]->tasks.push_back(root);
+        queues[0]->size = 1;
+        pending = 1;
+
+        std::vector<std::thread> workers;
+        for (unsigned k = 1; k < threads; k++) workers.emplace_back(&Solver::work, this, k);
+        work(0);
+        for (std::thread &worker : workers) worker.join();
+
+        std::uint64_t total = 0;
+        for (const auto &q : queues) total += q->count;
+        return total;
+    }
+};
+
+
+static int run_tests()
+{
+    struct Case { std::vector<int> diag; bool is_upper; std::uint64_t count; };
+    const std::vector<Case> cases = {  // TestAlgorithms.test_result_count
+        {{3, 1, 1, 1, 2, 2}, true, 1},
+        {{1, 2, 2, 2, 1, 1, 1, 1, 2, 3}, true, 2},
+        {{1, 2, 2, 2, 1, 1, 1, 1, 2, 3}, false, 258},
+        {{1, 3, 1, 2, 2, 1, 1, 1, 1, 2, 2, 3}, true, 2},
+        {{1, 3, 3, 2, 1, 1, 1, 1, 1, 3, 2, 3}, true, 3},
+        {{1, 3, 4, 4, 2, 2, 1, 1, 1, 1, 2, 2, 4, 4}, true, 0},
+        {{1, 3, 3, 3, 2, 2, 1, 1, 1, 1, 2, 2, 3, 3}, true, 0},
+        {{4, 1, 2, 1, 3, 2, 1, 2, 1, 1, 2, 2, 3, 1, 2, 3, 1, 2}, true, 1},
+        {{4, 3, 3, 3, 2, 1, 1, 2, 2, 2, 4, 5}, true, 10},
+        {{1, 1, 1, 1}, true, 1},  // all-zero sums: just the identity (solve() says 0, see Solver::run)
+    };
+    int failures = 0;
+    for (const Case &c : cases)
+        for (unsigned threads : {1u, 4u})
+        {
+            std::uint64_t count = Solver(c.diag, c.is_upper, false).run(threads);
+            if (count == c.count) continue;
+            std::fprintf(stderr, "case #%zu (%u threads): expected %llu solutions, got %llu\n",
+                         static_cast<std::size_t>(&c - cases.data()), threads,
+                         static_cast<unsigned long long>(c.count), static_cast<unsigned long long>(count));
+            failures++;
+        }
+    std::printf(failures ? "FAILED (failures=%d)\n" : "OK\n", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && std::strcmp(argv[1], "test") == 0) return run_tests();
+
+    std::vector<int> diag;
+    bool is_upper = true, is_printing = true;
+    unsigned threads = std::thread::hardware_concurrency();
+    for (int a = 1; a < argc; a++)
+    {
+        if (std::strcmp(argv[a], "--all") == 0) is_upper = false;
+        else if (std::strcmp(argv[a], "--count") == 0) is_printing = false;
+        else if (std::strcmp(argv[a], "--threads") == 0 && a + 1 < argc) threads = std::strtoul(argv[++a], nullptr, 10);
+        else
+        {
+            char *end;
+            long value = std::strtol(argv[a], &end, 10);  // "3," is fine too, like the Python one's arguments
+            if (end == argv[a] || (*end != '\0' && std::strcmp(end, ",") != 0))
+            {
+                std::fprintf(stderr, "Not a number: %s\n", argv[a]);
+                return 1;
+            }
+            diag.push_back(static_cast<int>(value));
+        }
+    }
+    if (diag.empty())
+    {
+        std::fprintf(stderr, "You need to provide diagonal as array. Like so: %s 3 1 1 1 2 2 [--all] [--count] [--threads N]\n", argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        std::uint64_t count = Solver(diag, is_upper, is_printing).run(threads);
+        std::printf("All %ssolutions (%llu total) for [", is_upper ? "upper-triangular " : "", static_cast<unsigned long long>(count));
+        for (std::size_t k = 0; k < diag.size(); k++) std::printf(k ? ", %d" : "%d", diag[k]);
+        std::printf("]\n");
+    }
+    catch (const std::invalid_argument &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 #!/usr/bin/python3
 
-"""Calculates which matrices correspond to given diagonal, use like so: <this file> 3 1 1 1 2 2"""
+"""Calculates which matrices correspond to given diagonal, use like so: <this file> 3 1 1 1 2 2
+    (dfs_matrix_from_diag.cpp does the same search natively, in parallel, for inputs too big for this one)"""
 """ Constraints:
     Each row and column has a set sum
     We know that every solution can be represented as upper-triangular, so we only need to focus on 1's in half the area